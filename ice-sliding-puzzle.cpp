@@ -4,18 +4,55 @@
 // ----------------------------------------------------------------------------
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <coroutine>
+#include <unordered_set>
+#include <iterator>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <random>
 #include <algorithm>
 #include <limits>
+#include <type_traits>
 #include <assert.h>
 #include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 using Distance = uint8_t;
 const int GLOBAL_BUFFER_SIZE = 64*64;
 const bool USE_SENTINEL_OPTIMIZATION = true;
 
-std::default_random_engine rng;
-std::uniform_real_distribution<double> uniform(0.0, 1.0);
+// Build with -DICE_STATS=1 to count what the solver and searches do (see Statistics)
+#ifndef ICE_STATS
+#define ICE_STATS 0
+#endif
+const bool COLLECT_STATS = ICE_STATS;
+
+// Each thread has its own random generator and solver buffers
+thread_local std::default_random_engine rng;
+thread_local std::uniform_real_distribution<double> uniform(0.0, 1.0);
 int random_range(int n) {
   std::uniform_int_distribution<int> distribution(0,n-1);
   return distribution(rng);
@@ -28,26 +65,73 @@ double random_double() {
 // Parameters
 // ----------------------------------------------------------------------------
 
+// Row and column of each position, so we don't need division in the hot loops.
+// Indexed by pos + ROW_STRIDE, so that positions in the sentinel rows are included.
+template <int ROW_STRIDE, int MAX_H>
+struct CoordTables {
+  using Entry = typename std::conditional<ROW_STRIDE <= 256 && MAX_H+2 <= 256, uint8_t, uint16_t>::type;
+  static const int SIZE = ROW_STRIDE * (MAX_H+2);
+  Entry row[SIZE];
+  Entry col[SIZE];
+  constexpr CoordTables() : row(), col() {
+    for (int i = 0; i < SIZE; ++i) {
+      row[i] = i / ROW_STRIDE;
+      col[i] = i % ROW_STRIDE;
+    }
+  }
+};
+
 // We pass parameters via template arguments, so the compiler can optimize stuff for us.
-template <int MAX_W_, int MAX_H_, bool EDGES_ARE_WALLS_ = true>
+template <int MAX_W_, int MAX_H_, bool EDGES_ARE_WALLS_ = true, bool ALLOW_SENTINELS_ = USE_SENTINEL_OPTIMIZATION>
 struct Params {
   static const bool EDGES_ARE_WALLS = EDGES_ARE_WALLS_;
-  static const bool SENTINELS = USE_SENTINEL_OPTIMIZATION && EDGES_ARE_WALLS; // can we use sentinels as an optimization?
+  static const bool SENTINELS = ALLOW_SENTINELS_ && EDGES_ARE_WALLS; // can we use sentinels as an optimization?
   static const int MAX_W = SENTINELS ? MAX_W_ - 1 : MAX_W_;
   static const int MAX_H = MAX_H_;
   static const int ROW_STRIDE = MAX_W_;
   static const int BUFFER_SIZE = ROW_STRIDE * MAX_H; // size needed for buffers (that don't store sentinels)
+  // The transposed (column-major) grid has the same layout with the roles of rows and columns swapped
+  static const int COL_STRIDE = SENTINELS ? MAX_H + 1 : MAX_H;
+  static const int TRANSPOSED_BUFFER_SIZE = COL_STRIDE * MAX_W;
+  // Smallest type that can store any position, including sentinels just outside the grid
+  using Index = typename std::conditional<ROW_STRIDE * (MAX_H+2) <= std::numeric_limits<int16_t>::max(), int16_t, int>::type;
+
+  // Row and column of a position.
+  // With a power of two stride this is a shift and a mask, otherwise we use a lookup table.
+  static const bool POW2_STRIDE = (ROW_STRIDE & (ROW_STRIDE - 1)) == 0;
+  static constexpr CoordTables<POW2_STRIDE ? 1 : ROW_STRIDE, POW2_STRIDE ? 0 : MAX_H> TABLES{};
+  static inline constexpr int row_of(int pos) {
+    if (POW2_STRIDE) return pos >> log2(ROW_STRIDE);
+    return TABLES.row[pos + ROW_STRIDE] - 1;
+  }
+  static inline constexpr int col_of(int pos) {
+    if (POW2_STRIDE) return pos & (ROW_STRIDE - 1);
+    return TABLES.col[pos + ROW_STRIDE];
+  }
+private:
+  static constexpr int log2(int x) {
+    return x <= 1 ? 0 : 1 + log2(x / 2);
+  }
 };
 
 // ----------------------------------------------------------------------------
 // Puzzles + solver
 // ----------------------------------------------------------------------------
 
+enum Direction {
+  LEFT, RIGHT, UP, DOWN
+};
+
+template <typename Params>
+inline constexpr int direction_delta(int dir) {
+  return dir == LEFT ? -1 : dir == RIGHT ? 1 : dir == UP ? -Params::ROW_STRIDE : Params::ROW_STRIDE;
+}
+
 // We encode coordinates as x + y * MAX_W
 template <typename Params>
 struct Coord {
 private:
-  int pos;
+  typename Params::Index pos;
 public:
   inline Coord() {}
   inline constexpr Coord(int pos) : pos(pos) {}
@@ -57,21 +141,25 @@ public:
   }
 
   inline constexpr int row() const {
-    return (pos / Params::ROW_STRIDE);
+    return Params::row_of(pos);
   }
   inline constexpr int col() const {
-    return pos % Params::ROW_STRIDE;
+    return Params::col_of(pos);
   }
   inline constexpr int with_row(int row) const {
     return Coord(col(), row);
   }
   inline constexpr int with_col(int col) const {
-    return Coord(col, row());
+    return pos - this->col() + col;
+  }
+  // position in the transposed grid: y + x * COL_STRIDE
+  inline constexpr int transposed() const {
+    return row() + col() * Params::COL_STRIDE;
   }
   
   inline constexpr Coord next(int w) {
     int next = pos + 1;
-    if (next % Params::ROW_STRIDE == w) {
+    if (Params::col_of(next) == w) {
       next = next - w + Params::ROW_STRIDE;
     }
     return next;
@@ -87,6 +175,11 @@ private:
   // The actual obstacles are located at grid[Coord(x,y+1)]
   // this means that the max puzzle size is MAX_W-1 by MAX_H
   bool grid[Params::ROW_STRIDE * (Params::SENTINELS ? Params::MAX_H+2 : Params::MAX_H)];
+  // We also keep a transposed copy of the grid, so vertical slides scan contiguous memory.
+  // The obstacle at (x,y) is also located at grid_t[Coord(x,y).transposed() + COL_STRIDE]
+  bool grid_t[Params::COL_STRIDE * (Params::SENTINELS ? Params::MAX_W+2 : Params::MAX_W)];
+  static const int OFFSET   = Params::SENTINELS ? Params::ROW_STRIDE : 0;
+  static const int OFFSET_T = Params::SENTINELS ? Params::COL_STRIDE : 0;
   void init_sentinels() {
     if (Params::SENTINELS) {
       std::fill_n(&grid[0], Params::ROW_STRIDE, true);
@@ -95,6 +188,12 @@ private:
         grid[(y+1)*Params::ROW_STRIDE-1] = true;
         grid[(y+1)*Params::ROW_STRIDE+w] = true;
       }
+      std::fill_n(&grid_t[0], Params::COL_STRIDE, true);
+      std::fill_n(&grid_t[(w+1)*Params::COL_STRIDE], Params::COL_STRIDE, true);
+      for (int x=0; x<w; ++x) {
+        grid_t[(x+1)*Params::COL_STRIDE-1] = true;
+        grid_t[(x+1)*Params::COL_STRIDE+h] = true;
+      }
     }
   }
 public:
@@ -111,7 +210,7 @@ public:
     
     void operator ++() {
       ++pos;
-      if (pos % Params::ROW_STRIDE == w) {
+      if (Params::col_of(pos) == w) {
         pos = pos - w + Params::ROW_STRIDE;
       }
     }
@@ -134,14 +233,21 @@ public:
     return iterator(h * Params::ROW_STRIDE, w);
   }
   
-  inline bool operator [] (Coord pos) const {
-    return grid[pos + (Params::SENTINELS ? Params::ROW_STRIDE : 0)];
+  inline bool operator [] (int pos) const {
+    return grid[pos + OFFSET];
   }
-  inline bool& operator [] (Coord pos) {
-    return grid[pos + (Params::SENTINELS ? Params::ROW_STRIDE : 0)];
+  // obstacle at a position in the transposed grid, see Coord::transposed
+  inline bool transposed(int pos_t) const {
+    return grid_t[pos_t + OFFSET_T];
+  }
+  // both grids are updated together
+  inline void set(Coord pos, bool obstacle) {
+    grid[pos + OFFSET] = obstacle;
+    grid_t[pos.transposed() + OFFSET_T] = obstacle;
   }
   void clear() {
-    std::fill_n(grid + (Params::SENTINELS ? Params::ROW_STRIDE : 0), h*Params::ROW_STRIDE, false);
+    std::fill_n(grid + OFFSET, h*Params::ROW_STRIDE, false);
+    std::fill_n(grid_t + OFFSET_T, w*Params::COL_STRIDE, false);
     init_sentinels();
   }
   
@@ -151,6 +257,15 @@ public:
     clear();
   }
   Puzzle(std::initializer_list<std::string> const& data) {
+    parse(data);
+  }
+  explicit Puzzle(std::vector<std::string> const& data) {
+    parse(data);
+  }
+  
+  // Parse rows of text, with '#' for obstacles and 'S' for the start
+  template <typename Rows>
+  void parse(Rows const& data) {
     w = 0;
     h = 0;
     int y = 0;
@@ -163,12 +278,14 @@ public:
       for (int x=0; x<w; ++x) {
         char c = row[x];
         Coord pos = Coord(x,y);
-        (*this)[pos] = (c == '*' || c == '#');
+        set(pos, c == '*' || c == '#');
         if (c == '0' || c == 's' || c == 'S') start = pos;
       }
       h++;
       y++;
     }
+    assert(w > 0 && w <= Params::MAX_W);
+    assert(h > 0 && h <= Params::MAX_H);
     init_sentinels();
   }
   
@@ -193,63 +310,582 @@ public:
   }
 };
 
+// ----------------------------------------------------------------------------
+// Statistics
+// ----------------------------------------------------------------------------
+
+// Counters for the work that the solver and the searches do.
+// They are only collected when COLLECT_STATS is set, otherwise count_stat compiles to nothing.
+enum Stat {
+  SOLVES,              // calls to max_distance
+  BFS_NODES,           // stop points taken from the queue
+  SLIDE_CELLS,         // cells passed over while sliding
+  PASS_IMPROVEMENTS,   // cells whose pass distance improved
+  STOP_IMPROVEMENTS,   // stop points whose distance improved (added to the queue)
+  ENUMERATED,          // puzzles enumerated by exhaustive searches
+  NEIGHBOURS,          // puzzles generated by single_changes
+  NEIGHBOURS_IMPROVED, // neighbours that improved the score in greedy search
+  GREEDY_RUNS_DONE,    // greedy runs from a random puzzle
+  ANNEALING_STEPS,     // random changes tried in simulated annealing
+  ANNEALING_ACCEPTED,  // random changes that were kept
+  NUM_STATS
+};
+
+const char* const STAT_NAMES[NUM_STATS] = {
+  "solves", "bfs_nodes", "slide_cells", "pass_improvements", "stop_improvements", "enumerated",
+  "neighbours", "neighbours_improved", "greedy_runs", "annealing_steps", "annealing_accepted"
+};
+
+// Phases of the solver and the searches, for hardware performance counters (see below)
+enum Phase {
+  PHASE_RESET,     // resetting the distance buffers
+  PHASE_BFS,       // breadth first search, including the pass distance updates during slides
+  PHASE_ENUMERATE, // one step of the exhaustive enumeration
+  PHASE_MOVES,     // generating a neighbour or random change of a puzzle
+  NUM_PHASES
+};
+const char* const PHASE_NAMES[NUM_PHASES] = {"reset", "bfs", "enumerate", "moves"};
+
+enum PerfEvent {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  NUM_PERF_EVENTS
+};
+const char* const PERF_EVENT_NAMES[NUM_PERF_EVENTS] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+// Per phase we sum the counter values and the number of samples
+const int PERF_VALUES = NUM_PERF_EVENTS + 1;
+const int NUM_COUNTERS = NUM_STATS + NUM_PHASES * PERF_VALUES;
+inline int perf_counter(Phase phase, int value) {
+  return NUM_STATS + phase * PERF_VALUES + value;
+}
+
+struct ThreadStats;
+
+// All threads that have counters, and the totals of threads that have finished
+struct StatsRegistry {
+  std::mutex mutex;
+  std::vector<ThreadStats*> threads;
+  uint64_t finished[NUM_COUNTERS] = {};
+};
+StatsRegistry stats_registry;
+
+// Counters of one thread. Only the owning thread writes them, but other threads can read them for a report
+// (so they are atomics, but updated with plain loads and stores).
+struct ThreadStats {
+  std::atomic<uint64_t> counts[NUM_COUNTERS] = {};
+  
+  ThreadStats() {
+    std::lock_guard<std::mutex> lock(stats_registry.mutex);
+    stats_registry.threads.push_back(this);
+  }
+  ~ThreadStats() {
+    std::lock_guard<std::mutex> lock(stats_registry.mutex);
+    for (int i = 0; i < NUM_COUNTERS; ++i) stats_registry.finished[i] += counts[i].load(std::memory_order_relaxed);
+    auto& threads = stats_registry.threads;
+    threads.erase(std::find(threads.begin(), threads.end(), this));
+  }
+  
+  inline void add(int counter, uint64_t n) {
+    counts[counter].store(counts[counter].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+};
+thread_local ThreadStats thread_stats;
+
+inline void count_stat(Stat stat, uint64_t n = 1) {
+  if (COLLECT_STATS) thread_stats.add(stat, n);
+}
+
+// Sum of the counters of all threads
+std::vector<uint64_t> total_stats() {
+  std::lock_guard<std::mutex> lock(stats_registry.mutex);
+  std::vector<uint64_t> totals(stats_registry.finished, stats_registry.finished + NUM_COUNTERS);
+  for (auto* thread : stats_registry.threads) {
+    for (int i = 0; i < NUM_COUNTERS; ++i) totals[i] += thread->counts[i].load(std::memory_order_relaxed);
+  }
+  return totals;
+}
+
+void write_stats(std::ostream& out, bool json) {
+  auto totals = total_stats();
+  if (json) {
+    out << "{";
+    for (int i = 0; i < NUM_STATS; ++i) out << (i ? "," : "") << "\"" << STAT_NAMES[i] << "\":" << totals[i];
+    out << "}" << std::endl;
+  } else {
+    for (int i = 0; i < NUM_STATS; ++i) out << STAT_NAMES[i] << " " << totals[i] << "\n";
+    out << std::flush;
+  }
+}
+
+// Print the counters to stderr whenever the process gets SIGUSR1.
+// The signal is blocked in all threads and picked up by a dedicated thread, which is free to take locks.
+// Must be called before any other thread is started, so they inherit the signal mask.
+void report_stats_on_signal() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread([signals]() {
+    while (true) {
+      int signal;
+      if (sigwait(&signals, &signal) == 0) write_stats(std::cerr, false);
+    }
+  }).detach();
+}
+
+// ----------------------------------------------------------------------------
+// Hardware performance counters
+// ----------------------------------------------------------------------------
+
+// With --perf (in a build with statistics), we read the CPU's counters for cycles, instructions,
+// cache and branch misses with perf_event_open, and attribute them to phases of the solver and searches.
+// Reading the counters is a system call, which costs more than a whole solve of a small puzzle,
+// so only one in PERF_SAMPLE_INTERVAL phases is measured. Only user space is counted.
+const unsigned PERF_SAMPLE_INTERVAL = 256;
+std::atomic<bool> perf_enabled{false};
+std::mutex perf_error_mutex;
+std::string perf_error; // why counters are unavailable, if they are
+std::atomic<int> perf_events_opened{0}; // bit mask of the events that could be opened
+
+// The counters of the calling thread, as one group that is read with a single system call
+class PerfGroup {
+public:
+  PerfGroup() {
+    std::fill_n(index, NUM_PERF_EVENTS, -1);
+#ifdef __linux__
+    struct { uint32_t type; uint64_t config; } events[NUM_PERF_EVENTS] = {
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events[e].type;
+      attr.config = events[e].config;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+      if (fd < 0) {
+        // without the leader (cycles) there is no group, other events are optional
+        if (leader < 0) {
+          set_error(std::string("perf_event_open: ") + strerror(errno));
+          return;
+        }
+        continue;
+      }
+      if (leader < 0) leader = fd;
+      fds[num_open] = fd;
+      index[e] = num_open++;
+      perf_events_opened |= 1 << e;
+    }
+#else
+    set_error("hardware counters are only supported on Linux");
+#endif
+  }
+  ~PerfGroup() {
+    for (int i = 0; i < num_open; ++i) close(fds[i]);
+  }
+  
+  bool ok() const {
+    return leader >= 0;
+  }
+  bool has(int event) const {
+    return index[event] >= 0;
+  }
+  
+  // Current counter values, 0 for unavailable events
+  bool read(uint64_t* values) const {
+    struct { uint64_t nr; uint64_t values[NUM_PERF_EVENTS]; } data;
+    if (::read(leader, &data, sizeof(data)) < (ssize_t)sizeof(uint64_t)) return false;
+    for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+      values[e] = has(e) ? data.values[index[e]] : 0;
+    }
+    return true;
+  }
+  
+private:
+  int leader = -1;
+  int num_open = 0;
+  int fds[NUM_PERF_EVENTS];
+  int index[NUM_PERF_EVENTS]; // position of each event in the group, -1 if unavailable
+  
+  static void set_error(std::string const& error) {
+    std::lock_guard<std::mutex> lock(perf_error_mutex);
+    if (perf_error.empty()) perf_error = error;
+  }
+};
+
+thread_local PerfGroup* perf_group = nullptr;
+thread_local std::unique_ptr<PerfGroup> perf_group_owner;
+thread_local unsigned perf_ticks[NUM_PHASES] = {};
+
+// Should this phase be measured?
+// Each phase has its own tick count, phases that alternate would otherwise never be sampled.
+inline bool perf_sample(Phase phase) {
+  if (!COLLECT_STATS || !perf_enabled.load(std::memory_order_relaxed)) return false;
+  if (++perf_ticks[phase] % PERF_SAMPLE_INTERVAL != 0) return false;
+  if (!perf_group_owner) {
+    perf_group_owner.reset(new PerfGroup());
+    if (perf_group_owner->ok()) perf_group = perf_group_owner.get();
+  }
+  return perf_group;
+}
+
+// Measures a phase if it is sampled. Phases can follow each other with next(), which reuses the last reading.
+class PerfPhase {
+public:
+  PerfPhase(Phase phase) : phase(phase), active(perf_sample(phase)) {
+    if (active) active = perf_group->read(start);
+  }
+  ~PerfPhase() {
+    stop();
+  }
+  void next(Phase next_phase) {
+    if (!active) return;
+    uint64_t now[NUM_PERF_EVENTS];
+    if (!perf_group->read(now)) {
+      active = false;
+      return;
+    }
+    add(now);
+    std::copy_n(now, NUM_PERF_EVENTS, start);
+    phase = next_phase;
+  }
+  void stop() {
+    if (!active) return;
+    uint64_t now[NUM_PERF_EVENTS];
+    if (perf_group->read(now)) add(now);
+    active = false;
+  }
+  
+private:
+  Phase phase;
+  bool active;
+  uint64_t start[NUM_PERF_EVENTS];
+  
+  void add(const uint64_t* now) {
+    for (int e = 0; e < NUM_PERF_EVENTS; ++e) thread_stats.add(perf_counter(phase, e), now[e] - start[e]);
+    thread_stats.add(perf_counter(phase, NUM_PERF_EVENTS), 1);
+  }
+};
+
+// Print the counters per phase, between two snapshots of total_stats()
+void write_perf_report(std::ostream& out, std::vector<uint64_t> const& before, std::vector<uint64_t> const& after) {
+  {
+    std::lock_guard<std::mutex> lock(perf_error_mutex);
+    if (!perf_error.empty()) {
+      out << "hardware counters unavailable: " << perf_error << std::endl;
+      return;
+    }
+  }
+  auto value = [&](int phase, int v) { return after[perf_counter((Phase)phase, v)] - before[perf_counter((Phase)phase, v)]; };
+  char line[200];
+  snprintf(line, sizeof(line), "%-10s %8s", "phase", "samples");
+  out << line;
+  for (auto name : PERF_EVENT_NAMES) {
+    snprintf(line, sizeof(line), " %13s", name);
+    out << line;
+  }
+  out << "   IPC  (per sample)" << std::endl;
+  for (int p = 0; p < NUM_PHASES; ++p) {
+    uint64_t samples = value(p, NUM_PERF_EVENTS);
+    if (samples == 0) continue;
+    snprintf(line, sizeof(line), "%-10s %8llu", PHASE_NAMES[p], (unsigned long long)samples);
+    out << line;
+    for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+      if (perf_events_opened & (1 << e)) {
+        snprintf(line, sizeof(line), " %13.1f", (double)value(p, e) / samples);
+      } else {
+        snprintf(line, sizeof(line), " %13s", "-");
+      }
+      out << line;
+    }
+    uint64_t cycles = value(p, PERF_CYCLES), instructions = value(p, PERF_INSTRUCTIONS);
+    if (cycles && instructions) {
+      snprintf(line, sizeof(line), " %5.2f", (double)instructions / cycles);
+      out << line;
+    }
+    out << std::endl;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Tracing
+// ----------------------------------------------------------------------------
+
+// With --trace FILE we record spans of the searches (jobs, subtasks, start locations, restarts,
+// temperature levels, pipeline batches and waits), and write them in the Chrome trace event format,
+// which chrome://tracing and Perfetto can show.
+// Each thread appends to its own buffer without locking. Buffers are kept until they are written at exit.
+struct TraceEvent {
+  const char* name;
+  char phase;        // 'X' for a span, 'b' and 'e' for the begin and end of an async span
+  int64_t start;     // microseconds since the tracer was enabled
+  int64_t duration;
+  uint64_t id;       // for async spans
+  const char* arg_names[2];
+  double args[2];
+};
+
+struct TraceBuffer {
+  int tid;
+  std::string thread_name;
+  std::vector<TraceEvent> events;
+};
+
+class Tracer {
+public:
+  void enable() {
+    origin = std::chrono::steady_clock::now();
+    enabled_ = true;
+  }
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+  }
+  
+  TraceBuffer* add_thread() {
+    std::lock_guard<std::mutex> lock(mutex);
+    buffers.emplace_back(new TraceBuffer());
+    buffers.back()->tid = (int)buffers.size();
+    buffers.back()->events.reserve(1024);
+    return buffers.back().get();
+  }
+  
+  // All threads that traced something must have finished, or at least stopped tracing
+  void write(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&]() {
+      if (!first) out << ",\n";
+      first = false;
+    };
+    for (auto const& buffer : buffers) {
+      if (!buffer->thread_name.empty()) {
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"" << buffer->thread_name << "\"}}";
+      }
+      for (auto const& event : buffer->events) {
+        separator();
+        out << "{\"name\":\"" << event.name << "\",\"cat\":\"search\",\"ph\":\"" << event.phase
+            << "\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << event.start;
+        if (event.phase == 'X') out << ",\"dur\":" << event.duration;
+        else out << ",\"id\":" << event.id;
+        if (event.arg_names[0]) {
+          out << ",\"args\":{\"" << event.arg_names[0] << "\":" << event.args[0];
+          if (event.arg_names[1]) out << ",\"" << event.arg_names[1] << "\":" << event.args[1];
+          out << "}";
+        }
+        out << "}";
+      }
+    }
+    out << "\n]}" << std::endl;
+  }
+  
+private:
+  std::atomic<bool> enabled_{false};
+  std::chrono::steady_clock::time_point origin;
+  std::mutex mutex; // protects the list of buffers, not their contents
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+Tracer tracer;
+thread_local TraceBuffer* trace_buffer = nullptr;
+
+inline TraceBuffer& thread_trace_buffer() {
+  if (!trace_buffer) trace_buffer = tracer.add_thread();
+  return *trace_buffer;
+}
+
+// Name the calling thread in the trace
+void trace_thread_name(std::string const& name) {
+  if (tracer.enabled()) thread_trace_buffer().thread_name = name;
+}
+
+// Record an event with up to two numeric arguments
+inline void trace_event(const char* name, char phase, int64_t start, int64_t duration, uint64_t id,
+                        const char* arg0 = nullptr, double value0 = 0, const char* arg1 = nullptr, double value1 = 0) {
+  thread_trace_buffer().events.push_back(TraceEvent{name, phase, start, duration, id, {arg0, arg1}, {value0, value1}});
+}
+
+// Spans that start and end on different threads, such as jobs
+inline void trace_async_begin(const char* name, uint64_t id, const char* arg0 = nullptr, double value0 = 0) {
+  if (tracer.enabled()) trace_event(name, 'b', tracer.now(), 0, id, arg0, value0);
+}
+inline void trace_async_end(const char* name, uint64_t id) {
+  if (tracer.enabled()) trace_event(name, 'e', tracer.now(), 0, id);
+}
+
+// A span from construction to destruction, on the current thread
+class TraceSpan {
+public:
+  TraceSpan(const char* name, const char* arg0 = nullptr, double value0 = 0, const char* arg1 = nullptr, double value1 = 0)
+    : name(name), arg0(arg0), arg1(arg1), value0(value0), value1(value1), start(tracer.enabled() ? tracer.now() : -1) {}
+  ~TraceSpan() {
+    if (start >= 0) trace_event(name, 'X', start, tracer.now() - start, 0, arg0, value0, arg1, value1);
+  }
+  TraceSpan(TraceSpan const&) = delete;
+  TraceSpan& operator = (TraceSpan const&) = delete;
+  
+private:
+  const char* name;
+  const char* arg0;
+  const char* arg1;
+  double value0, value1;
+  int64_t start;
+};
+
 // ----------------------------------------------------------------------------
 // Distance calculation / solver
 // ----------------------------------------------------------------------------
 
 const Distance UNREACHABLE = std::numeric_limits<Distance>::max() - 1;
-Distance dists[GLOBAL_BUFFER_SIZE];
-Distance pass_dists[GLOBAL_BUFFER_SIZE];
-int come_from[GLOBAL_BUFFER_SIZE];
+thread_local Distance dists[GLOBAL_BUFFER_SIZE];
+thread_local Distance pass_dists[GLOBAL_BUFFER_SIZE];
+thread_local Distance pass_dists_t[GLOBAL_BUFFER_SIZE]; // copy of pass_dists in transposed order
+// For each stop point: the direction of the move that reached it, packed as 2 bits per cell
+thread_local uint8_t come_from[GLOBAL_BUFFER_SIZE / 4];
+
+// Number of cells that the last call to max_distance found reachable, including the start
+thread_local int reachable_cells;
+
+// Optional metrics of max_distance<track_come_from, true>, to pick puzzles without a second pass:
+// the number of cells at the maximum distance, one of them, and for each cell and stop point
+// the number of distinct shortest move sequences that pass it (or stop there), saturating at PATHS_SATURATED.
+const int PATHS_SATURATED = 255;
+thread_local int max_distance_cells;
+thread_local int max_distance_cell;
+thread_local uint8_t pass_paths[GLOBAL_BUFFER_SIZE];
+thread_local uint8_t stop_paths[GLOBAL_BUFFER_SIZE];
+
+inline uint8_t add_paths(int a, int b) {
+  return (uint8_t)std::min(a + b, PATHS_SATURATED);
+}
+
+#ifdef BENCHMARK
+// Number of searches from one start (calls to max_distance, and starts solved by all_pairs),
+// so benchmarks can count the work a search does
+thread_local long long solver_calls = 0;
+#endif
+
+inline void set_come_from(int pos, int dir) {
+  int shift = (pos & 3) * 2;
+  come_from[pos >> 2] = (come_from[pos >> 2] & ~(3 << shift)) | (dir << shift);
+}
+inline int get_come_from(int pos) {
+  return (come_from[pos >> 2] >> ((pos & 3) * 2)) & 3;
+}
 
 // Returns maximum distance that can be traveled to reach any point
-template <bool track_come_from = false, typename Params>
+template <bool track_come_from = false, bool with_metrics = false, typename Params>
 int max_distance(Puzzle<Params> const& puzzle) {
   using Coord = ::Coord<Params>;
   Coord queue[Params::MAX_W*Params::MAX_H];
   int queue_start = 0, queue_end = 0;
   Distance max_dist = 0;
+  int reached = 1;
+  int slide_cells = 0, stop_improvements = 0; // for statistics
 
   static_assert(Params::BUFFER_SIZE <= GLOBAL_BUFFER_SIZE);
-  std::fill_n(dists,      Params::ROW_STRIDE*puzzle.h, UNREACHABLE);
-  std::fill_n(pass_dists, Params::ROW_STRIDE*puzzle.h, UNREACHABLE);
+  static_assert(Params::TRANSPOSED_BUFFER_SIZE <= GLOBAL_BUFFER_SIZE);
+#ifdef BENCHMARK
+  solver_calls++;
+#endif
+  PerfPhase perf(PHASE_RESET);
+  std::fill_n(dists,        Params::ROW_STRIDE*puzzle.h, UNREACHABLE);
+  std::fill_n(pass_dists,   Params::ROW_STRIDE*puzzle.h, UNREACHABLE);
+  std::fill_n(pass_dists_t, Params::COL_STRIDE*puzzle.w, UNREACHABLE);
+  if (with_metrics) {
+    std::fill_n(pass_paths, Params::ROW_STRIDE*puzzle.h, 0);
+    std::fill_n(stop_paths, Params::ROW_STRIDE*puzzle.h, 0);
+    pass_paths[puzzle.start] = stop_paths[puzzle.start] = 1;
+    max_distance_cells = 1;
+    max_distance_cell = puzzle.start;
+  }
+  perf.next(PHASE_BFS);
   
   queue[queue_end++] = puzzle.start;
-  dists[puzzle.start] = pass_dists[puzzle.start] = 0;
+  dists[puzzle.start] = pass_dists[puzzle.start] = pass_dists_t[puzzle.start.transposed()] = 0;
   
   while (queue_start < queue_end) {
     Coord pos = queue[queue_start++];
     const Distance dist = dists[pos];
     const Distance next_dist = dist + 1;
+    // all stop points at dist-1 have been expanded, so this count is complete
+    const int paths = with_metrics ? stop_paths[pos] : 0;
+    const int pos_t = pos.transposed();
     // check move in all four directions
-    auto check_in_direction = [&](int delta, int bound) {
-      Coord p = pos;
+    // horizontal moves scan the grid, vertical moves scan the transposed grid,
+    // so in both cases we read contiguous memory
+    auto check_in_direction = [&](int dir, int delta, int delta_t, bool vertical, int bound) {
+      int p = pos;
+      int p_t = pos_t;
       while (true) {
         // is next point free?
-        Coord p2 = p + delta;
+        int p2 = p + delta;
+        int p2_t = p_t + delta_t;
         if (!Params::EDGES_ARE_WALLS && p2 == bound) {
           // can't stop at the edge
           return;
         }
         // with sentinels we don't need bounds checking anymore
         if (!Params::SENTINELS && p2 == bound) break;
-        if (puzzle[p2]) break;
-        if (pass_dists[p2] > next_dist) {
-          pass_dists[p2] = next_dist;
-          if (track_come_from) come_from[p2] = pos;
+        if (vertical ? puzzle.transposed(p2_t) : puzzle[p2]) break;
+        if ((vertical ? pass_dists_t[p2_t] : pass_dists[p2]) > next_dist) {
+          pass_dists[p2] = pass_dists_t[p2_t] = next_dist;
+          if (with_metrics) {
+            pass_paths[p2] = paths;
+            if (next_dist > max_dist) {
+              max_distance_cells = 1;
+              max_distance_cell = p2;
+            } else {
+              max_distance_cells++;
+            }
+          }
           max_dist = next_dist; // we could stop here
+          reached++;
+        } else if (with_metrics && pass_dists[p2] == next_dist) {
+          pass_paths[p2] = add_paths(pass_paths[p2], paths);
         }
+        if (COLLECT_STATS) slide_cells++;
         p = p2;
+        p_t = p2_t;
       }
       if (dists[p] > next_dist) {
         dists[p] = next_dist;
+        if (track_come_from) set_come_from(p, dir);
+        if (with_metrics) stop_paths[p] = paths;
+        if (COLLECT_STATS) stop_improvements++;
         queue[queue_end++] = p;
+      } else if (with_metrics && dists[p] == next_dist) {
+        stop_paths[p] = add_paths(stop_paths[p], paths);
       }
     };
-    check_in_direction(-1, pos.with_col(-1));
-    check_in_direction(+1, pos.with_col(puzzle.w));
-    check_in_direction(-Params::ROW_STRIDE, pos.with_row(-1));
-    check_in_direction(+Params::ROW_STRIDE, pos.with_row(puzzle.h));
+    check_in_direction(LEFT,  -1, -Params::COL_STRIDE, false, pos.with_col(-1));
+    check_in_direction(RIGHT, +1, +Params::COL_STRIDE, false, pos.with_col(puzzle.w));
+    check_in_direction(UP,    -Params::ROW_STRIDE, -1, true, pos.with_row(-1));
+    check_in_direction(DOWN,  +Params::ROW_STRIDE, +1, true, pos.with_row(puzzle.h));
+  }
+  perf.stop();
+  reachable_cells = reached;
+  if (COLLECT_STATS) {
+    count_stat(SOLVES);
+    count_stat(BFS_NODES, queue_end);
+    count_stat(SLIDE_CELLS, slide_cells);
+    count_stat(PASS_IMPROVEMENTS, reached - 1);
+    count_stat(STOP_IMPROVEMENTS, stop_improvements);
   }
   return max_dist;
 }
@@ -273,6 +909,57 @@ Coord<Params> find_goal(Puzzle<Params> const& puzzle, int distance) {
   return puzzle.start;
 }
 
+// Find the stop point at distance dist-1 from which a move in direction dir passes pos.
+// Returns pos if there is no such point.
+// requires that max_distance() has been called to fill dists
+template <typename Params>
+Coord<Params> slide_start(Puzzle<Params> const& puzzle, Coord<Params> pos, int dir, int dist) {
+  const int delta = -direction_delta<Params>(dir);
+  const int dx = dir == LEFT ? 1 : dir == RIGHT ? -1 : 0;
+  const int dy = dir == UP ? 1 : dir == DOWN ? -1 : 0;
+  int x = pos.col(), y = pos.row();
+  Coord<Params> p = pos;
+  while (x >= 0 && x < puzzle.w && y >= 0 && y < puzzle.h && !puzzle[p]) {
+    if (dists[p] == dist - 1) return p;
+    p = p + delta;
+    x += dx;
+    y += dy;
+  }
+  return pos;
+}
+
+// Direction of a move that passes the goal, coming from a stop point at distance pass_dists[goal]-1
+template <typename Params>
+int goal_come_from(Puzzle<Params> const& puzzle, Coord<Params> goal) {
+  for (int dir = 0; dir < 4; ++dir) {
+    if (slide_start(puzzle, goal, dir, pass_dists[goal]) != goal) return dir;
+  }
+  return LEFT;
+}
+
+const char DIRECTION_LETTERS[] = "LRUD";
+
+// The moves of a shortest solution that ends by passing the goal, as letters L, R, U, D.
+// Writes at most pass_dists[goal] letters to moves, and returns the number of moves.
+// requires that max_distance<true>() has been called to fill come_from
+template <typename Params>
+int solution_moves(Puzzle<Params> const& puzzle, Coord<Params> goal, char* moves) {
+  int dist = pass_dists[goal];
+  if (dist == UNREACHABLE) return 0;
+  // walk back from the goal, so the moves come out in reverse
+  auto pos = goal;
+  int move = goal_come_from(puzzle, goal);
+  for (int i = dist; i > 0; --i) {
+    moves[i-1] = DIRECTION_LETTERS[move];
+    auto from = slide_start(puzzle, pos, move, i);
+    if (from == pos) return 0; // shouldn't happen
+    pos = from;
+    if (i > 1) move = get_come_from(from);
+  }
+  return dist;
+}
+
+// requires that max_distance<true>() has been called to fill come_from
 template <typename Params>
 void show_path(Puzzle<Params> const& puzzle, Coord<Params> goal, const char** path) {
   using Coord = ::Coord<Params>;
@@ -280,11 +967,13 @@ void show_path(Puzzle<Params> const& puzzle, Coord<Params> goal, const char** pa
   std::fill_n(path, Params::BUFFER_SIZE, clear);
   path[goal] = "E";
   auto pos = goal;
-  while (pos != puzzle.start) {
-    Coord from = come_from[pos];
+  int dist = pass_dists[goal];
+  int move = goal_come_from(puzzle, goal);
+  while (pos != puzzle.start && dist > 0) {
+    Coord from = slide_start(puzzle, pos, move, dist);
     if (from == pos) return; // shouldn't happen
-    bool horizontal = from.row() == pos.row();
-    int dir = horizontal ? (from < pos ? -1 : 1) : (from < pos ? -Params::ROW_STRIDE : Params::ROW_STRIDE);
+    bool horizontal = move == LEFT || move == RIGHT;
+    int dir = -direction_delta<Params>(move);
     while (pos != from) {
       pos = pos + dir;
       if (path[pos] != clear) {
@@ -293,7 +982,9 @@ void show_path(Puzzle<Params> const& puzzle, Coord<Params> goal, const char** pa
         path[pos] = horizontal ? "─" : "│";
       }
     }
-    Coord next_from = come_from[from];
+    dist--;
+    move = get_come_from(from);
+    Coord next_from = dist > 0 ? slide_start(puzzle, from, move, dist) : from;
     if (dir == -1)                  path[pos] = next_from < pos ? "└" : "┌";
     if (dir ==  1)                  path[pos] = next_from < pos ? "┘" : "┐";
     if (dir == -Params::ROW_STRIDE) path[pos] = next_from < pos ? "┐" : "┌";
@@ -301,529 +992,3624 @@ void show_path(Puzzle<Params> const& puzzle, Coord<Params> goal, const char** pa
   }
 }
 
+// Append a puzzle as text to out, with the same layout as show().
+// Appending to a reused string is much faster than writing each cell to a stream, when rendering many puzzles.
+// requires that max_distance<true>() has been called for this puzzle, and goal = find_goal(puzzle, max_dist)
 template <typename Params>
-void show(Puzzle<Params> const& puzzle, Style style = Style::BOX_DRAWING, bool ansi_color = true) {
-  std::ostream& out = std::cout;
+void render(Puzzle<Params> const& puzzle, int max_dist, Coord<Params> goal, Style style, bool ansi_color, std::string& out) {
   const char* CLEAR = ansi_color ? "\033[0m" : "";
   const char* GREEN = ansi_color ? "\033[32;1m" : "";
   const char* BLUE = ansi_color ? "\033[34;1m" : "";
   const char* YELLOW = ansi_color ? "\033[33;1m" : "";
-  int max_dist = max_distance<true>(puzzle);
-  auto goal = find_goal(puzzle, max_dist);
   const char* box_drawing[Params::BUFFER_SIZE];
-  show_path(puzzle, goal, box_drawing);
-  out << puzzle.w << "×" << puzzle.h << " puzzle, " << puzzle.count_obstacles() << " obstacles, " << max_dist << " moves" << std::endl;
+  if (style == Style::BOX_DRAWING) show_path(puzzle, goal, box_drawing);
+  char header[128];
+  int n = snprintf(header, sizeof(header), "%d×%d puzzle, %d obstacles, %d moves\n", puzzle.w, puzzle.h, puzzle.count_obstacles(), max_dist);
+  out.append(header, n);
   for (int y=0; y<puzzle.h; ++y) {
     for (int x=0; x<puzzle.w; ++x) {
       auto pos = Coord<Params>(x,y);
       int dist = pass_dists[pos];
       if (puzzle[pos]) {
-        out << YELLOW << (style == Style::BOX_DRAWING ? "■" : "#") << CLEAR;
+        out += YELLOW;
+        out += style == Style::BOX_DRAWING ? "■" : "#";
+        out += CLEAR;
       } else if (dist == 0) {
-        out << GREEN << "S" << CLEAR;
+        out += GREEN;
+        out += 'S';
+        out += CLEAR;
       } else if (pos == goal) {
-        out << BLUE << "E" << CLEAR;
+        out += BLUE;
+        out += 'E';
+        out += CLEAR;
       } else if (style == Style::BOX_DRAWING) {
-        out << box_drawing[pos];
+        out += box_drawing[pos];
       } else if (dist >= UNREACHABLE || style == Style::PUZZLE_ONLY) {
-        out << '.';
+        out += '.';
       } else {
-        if (dist == max_dist) out << BLUE;
-        if (dist < 10) {
-          out << dist;
-        } else {
-          out << (char)(dist - 10 + 'a');
-        }
-        if (dist == max_dist) out << CLEAR;
+        if (dist == max_dist) out += BLUE;
+        out += (char)(dist < 10 ? dist + '0' : dist - 10 + 'a');
+        if (dist == max_dist) out += CLEAR;
       }
     }
-    out << std::endl;
+    out += '\n';
   }
 }
 
+template <typename Params>
+void show(Puzzle<Params> const& puzzle, Style style = Style::BOX_DRAWING, bool ansi_color = true, std::ostream& out = std::cout) {
+  thread_local std::string buffer;
+  int max_dist = max_distance<true>(puzzle);
+  auto goal = find_goal(puzzle, max_dist);
+  buffer.clear();
+  render(puzzle, max_dist, goal, style, ansi_color, buffer);
+  out.write(buffer.data(), buffer.size());
+  out.flush();
+}
+
 // ----------------------------------------------------------------------------
-// Greedy puzzle maker
+// Point-to-point queries
 // ----------------------------------------------------------------------------
 
-template <typename Params, typename F>
-void for_single_changes(Puzzle<Params> const& puzzle, bool swaps, bool reachable_only, F fun) {
-  using Coord = ::Coord<Params>;
-  // find out which cells are reachable
-  int reachable[Params::BUFFER_SIZE];
-  if (reachable_only) {
-    max_distance(puzzle);
-    std::copy(pass_dists, pass_dists+Params::ROW_STRIDE*puzzle.h, reachable);
+// The number of moves until one goal cell is passed (or stopped at), without flooding the whole puzzle
+// like max_distance. shortest_moves stops at the first move that passes the goal. shortest_moves_bidirectional
+// also searches back from the goal, over the stop points from which a move ends where the backward search
+// already is, and stops when the two searches meet, which visits far fewer stop points on large open grids.
+// Both return UNREACHABLE if the goal can't be reached, and if moves is not nullptr, write the moves of a
+// shortest solution (L, R, U, D) to it. They use the dists and come_from buffers, so they overwrite the
+// results of max_distance for stop points, but not pass_dists.
+
+// Moves from a cell until the goal is passed, and the direction of the first of these moves
+thread_local Distance back_dists[GLOBAL_BUFFER_SIZE];
+thread_local uint8_t back_dirs[GLOBAL_BUFFER_SIZE];
+
+inline int opposite_direction(int dir) {
+  return dir ^ 1;
+}
+
+// Slide from pos in direction dir, calling pass(p) for each cell on the way, including the last one.
+// Returns the stop point, or pos if there is no move in this direction: an obstacle next to pos,
+// or a slide off the edge when the edges aren't walls (which still passes the cells on its way, as in max_distance).
+template <typename Params, typename Pass>
+Coord<Params> slide(Puzzle<Params> const& puzzle, Coord<Params> pos, int dir, Pass&& pass) {
+  const int delta = direction_delta<Params>(dir);
+  const int dx = dir == LEFT ? -1 : dir == RIGHT ? 1 : 0;
+  const int dy = dir == UP ? -1 : dir == DOWN ? 1 : 0;
+  int x = pos.col() + dx, y = pos.row() + dy;
+  Coord<Params> p = pos;
+  while (x >= 0 && x < puzzle.w && y >= 0 && y < puzzle.h && !puzzle[p + delta]) {
+    p = p + delta;
+    pass(p);
+    x += dx;
+    y += dy;
   }
-  // for each obstacle, consider moving it to any location, and call fun
-  auto puzzle_new = puzzle;
-  for (auto obstacle : puzzle) {
-    if (puzzle[obstacle]) {
-      puzzle_new[obstacle] = false;
-      for (auto alt : puzzle) {
-        if (reachable_only && reachable[alt] == UNREACHABLE) {
-          // optimization: no path reaches this cell, so placing an obstacle here is useless
-          continue;
-        }
-        if (!puzzle[alt] && alt != puzzle.start) {
-          puzzle_new[alt] = true;
-          fun(puzzle_new);
-          puzzle_new[alt] = false;
+  bool off_edge = x < 0 || x >= puzzle.w || y < 0 || y >= puzzle.h;
+  return !Params::EDGES_ARE_WALLS && off_edge ? pos : p;
+}
+
+// Is there a move that stops at pos, coming from direction dir?
+template <typename Params>
+bool stops_at(Puzzle<Params> const& puzzle, Coord<Params> pos, int dir) {
+  int x = pos.col() + (dir == LEFT ? -1 : dir == RIGHT ? 1 : 0);
+  int y = pos.row() + (dir == UP ? -1 : dir == DOWN ? 1 : 0);
+  if (x < 0 || x >= puzzle.w || y < 0 || y >= puzzle.h) return Params::EDGES_ARE_WALLS;
+  return puzzle[pos + direction_delta<Params>(dir)];
+}
+
+// Searching back from a goal: the cells from which a move in direction dir passes the goal
+template <typename Params, typename Visit>
+void goal_predecessors(Puzzle<Params> const& puzzle, Coord<Params> goal, Visit&& visit) {
+  for (int dir = 0; dir < 4; ++dir) {
+    slide(puzzle, goal, opposite_direction(dir), [&](Coord<Params> p) { visit(p, dir); });
+  }
+}
+
+// Searching back: the cells from which a move in direction dir stops at pos
+template <typename Params, typename Visit>
+void slide_predecessors(Puzzle<Params> const& puzzle, Coord<Params> pos, Visit&& visit) {
+  for (int dir = 0; dir < 4; ++dir) {
+    if (!stops_at(puzzle, pos, dir)) continue;
+    slide(puzzle, pos, opposite_direction(dir), [&](Coord<Params> p) { visit(p, dir); });
+  }
+}
+
+// The moves that reach stop point pos, from dists and come_from as filled by a search from the start
+template <typename Params>
+void stop_point_moves(Puzzle<Params> const& puzzle, Coord<Params> pos, char* moves) {
+  for (int i = dists[pos]; i > 0; --i) {
+    int move = get_come_from(pos);
+    moves[i-1] = DIRECTION_LETTERS[move];
+    pos = slide_start(puzzle, pos, move, i);
+  }
+}
+
+template <typename Params>
+int shortest_moves(Puzzle<Params> const& puzzle, Coord<Params> goal, char* moves = nullptr) {
+  using Coord = ::Coord<Params>;
+  if (goal == puzzle.start) return 0;
+  if (puzzle[goal]) return UNREACHABLE;
+  Coord queue[Params::MAX_W*Params::MAX_H];
+  int queue_start = 0, queue_end = 0;
+  std::fill_n(dists, Params::ROW_STRIDE*puzzle.h, UNREACHABLE);
+  dists[puzzle.start] = 0;
+  queue[queue_end++] = puzzle.start;
+  while (queue_start < queue_end) {
+    Coord pos = queue[queue_start++];
+    const Distance next_dist = dists[pos] + 1;
+    for (int dir = 0; dir < 4; ++dir) {
+      bool passed = false;
+      Coord stop = slide(puzzle, pos, dir, [&](Coord p) { passed |= p == goal; });
+      if (passed) {
+        if (moves) {
+          stop_point_moves(puzzle, pos, moves);
+          moves[next_dist - 1] = DIRECTION_LETTERS[dir];
         }
+        return next_dist;
       }
-      puzzle_new[obstacle] = true;
-    }
-  }
-  // consider new start location
-  {
-    for (auto alt : puzzle) {
-      if (!puzzle[alt] && alt != puzzle.start) {
-        puzzle_new.start = alt;
-        fun(puzzle_new);
+      if (dists[stop] > next_dist) {
+        dists[stop] = next_dist;
+        set_come_from(stop, dir);
+        queue[queue_end++] = stop;
       }
     }
   }
-  // swap rows/columns
-  if (swaps) {
-    for (int x1 = 0; x1 < puzzle.w; ++x1) {
-      for (int x2 = x1+1; x2 < puzzle.w; ++x2) {
-        puzzle_new = puzzle;
-        for (int y = 0; y < puzzle.h; ++y) {
-          std::swap(puzzle_new[Coord(x1,y)], puzzle_new[Coord(x2,y)]);
-        }
-        if (puzzle.start.col() == x1) {
-          puzzle_new.start = Coord(x2, puzzle.start.row());
-        } else if (puzzle.start.col() == x2) {
-          puzzle_new.start = Coord(x1, puzzle.start.row());
+  return UNREACHABLE;
+}
+
+template <typename Params>
+int shortest_moves_bidirectional(Puzzle<Params> const& puzzle, Coord<Params> goal, char* moves = nullptr) {
+  using Coord = ::Coord<Params>;
+  if (goal == puzzle.start) return 0;
+  if (puzzle[goal]) return UNREACHABLE;
+  // each search keeps its current layer and builds the next one, and expands whichever layer is smaller
+  Coord forward[2][Params::MAX_W*Params::MAX_H], backward[2][Params::MAX_W*Params::MAX_H];
+  int forward_size = 0, backward_size = 0, next_size;
+  std::fill_n(dists,      Params::ROW_STRIDE*puzzle.h, UNREACHABLE);
+  std::fill_n(back_dists, Params::ROW_STRIDE*puzzle.h, UNREACHABLE);
+  int best = UNREACHABLE;
+  Coord meet = goal;
+  auto found = [&](Coord pos, int total) {
+    if (total < best) {
+      best = total;
+      meet = pos;
+    }
+  };
+  dists[puzzle.start] = 0;
+  forward[0][forward_size++] = puzzle.start;
+  // standing on the goal needs no more moves, but it isn't a layer of the backward search
+  back_dists[goal] = 0;
+  goal_predecessors(puzzle, goal, [&](Coord p, int dir) {
+    if (back_dists[p] != UNREACHABLE) return;
+    back_dists[p] = 1;
+    back_dirs[p] = dir;
+    backward[0][backward_size++] = p;
+    if (p == puzzle.start) found(p, 1);
+  });
+  int forward_layer = 0, backward_layer = 0;
+  while (best == UNREACHABLE && forward_size > 0 && backward_size > 0) {
+    next_size = 0;
+    if (forward_size <= backward_size) {
+      Coord* next = forward[1 - forward_layer % 2];
+      for (int i = 0; i < forward_size; ++i) {
+        Coord pos = forward[forward_layer % 2][i];
+        const Distance next_dist = dists[pos] + 1;
+        for (int dir = 0; dir < 4; ++dir) {
+          Coord stop = slide(puzzle, pos, dir, [](Coord) {});
+          if (dists[stop] <= next_dist) continue;
+          dists[stop] = next_dist;
+          set_come_from(stop, dir);
+          next[next_size++] = stop;
+          if (back_dists[stop] != UNREACHABLE) found(stop, next_dist + back_dists[stop]);
         }
-        fun(puzzle_new);
       }
-    }
-    for (int y1 = 0; y1 < puzzle.h; ++y1) {
-      for (int y2 = y1+1; y2 < puzzle.h; ++y2) {
-        puzzle_new = puzzle;
-        for (int x = 0; x < puzzle.w; ++x) {
-          std::swap(puzzle_new[Coord(x,y1)], puzzle_new[Coord(x,y2)]);
-        }
-        if (puzzle.start.row() == y1) {
-          puzzle_new.start = Coord(puzzle.start.col(), y2);
-        } else if (puzzle.start.row() == y2) {
-          puzzle_new.start = Coord(puzzle.start.col(), y1);
-        }
-        fun(puzzle_new);
+      forward_layer++;
+      forward_size = next_size;
+    } else {
+      Coord* next = backward[1 - backward_layer % 2];
+      for (int i = 0; i < backward_size; ++i) {
+        Coord pos = backward[backward_layer % 2][i];
+        const Distance next_dist = back_dists[pos] + 1;
+        slide_predecessors(puzzle, pos, [&](Coord p, int dir) {
+          if (back_dists[p] != UNREACHABLE) return;
+          back_dists[p] = next_dist;
+          back_dirs[p] = dir;
+          next[next_size++] = p;
+          if (dists[p] != UNREACHABLE) found(p, dists[p] + next_dist);
+        });
       }
+      backward_layer++;
+      backward_size = next_size;
+    }
+  }
+  if (best != UNREACHABLE && moves) {
+    stop_point_moves(puzzle, meet, moves);
+    for (int i = dists[meet]; i < best; ++i) {
+      moves[i] = DIRECTION_LETTERS[back_dirs[meet]];
+      meet = slide(puzzle, meet, back_dirs[meet], [](Coord) {});
     }
   }
+  return best;
 }
 
-template <typename Params>
-Puzzle<Params> greedy_optimize(Puzzle<Params> const& initial, bool verbose = false) {
-  auto best = initial;
-  int best_score = max_distance(best);
-  const bool accept_same_score = false;
-  const int BUDGET = accept_same_score ? 10 : 1;
-  const bool USE_SWAPS = false;
-  const bool REACHABLE_ONLY = true;
-  int budget = BUDGET;
+// ----------------------------------------------------------------------------
+// All-pairs distances
+// ----------------------------------------------------------------------------
+
+// Pass distances from every possible start of one obstacle layout, to find the best start and goal
+// without a max_distance call per start. Cells are numbered row-major (x + y*w), and sets of cells are bitsets.
+// The slide table has the stop point of each move, and the cells passed by the moves from each cell,
+// so a breadth first search from one start ORs the bitsets of a whole level of stop points at a time.
+
+struct SlideTable {
+  static constexpr int NO_MOVE = -1;  // blocked by an obstacle or a wall right next to the cell
+  static constexpr int OFF_EDGE = -2; // slides off the edge, when the edges aren't walls
+  int w = 0, h = 0;
+  int words = 0;                // 64 bit words per set of cells
+  std::vector<bool> obstacles;
+  std::vector<int> stops;       // [cell*4 + dir]: the stop point of the move, or NO_MOVE or OFF_EDGE
+  std::vector<uint64_t> passes; // [cell*words ...]: the cells passed by any move from cell
   
-  while (budget > 0) {
-    budget--;
-    auto cur = best;
-    int num_equiv = 1; // number of puzzles with the same score as best
-    bool swaps = USE_SWAPS && (budget == BUDGET || budget == 0);
-    for_single_changes(cur, swaps, REACHABLE_ONLY, [&](Puzzle<Params> const& p) {
-      int score = max_distance(p);
-      if (score > best_score) {
-        best = p;
-        best_score = score;
-        budget = BUDGET;
-        if (verbose) {
-          show(best);
-          std::cout << std::endl;
-        }
-      } else if (accept_same_score && score == best_score) {
-        num_equiv++;
-        // accept with probability 1/num_equiv
-        if (random_range(num_equiv) == 0) {
-          best = p;
-        }
-      }
-    });
+  uint64_t const* passed_from(int cell) const {
+    return &passes[cell * words];
   }
-  return best;
-}
+};
 
 template <typename Params>
-Puzzle<Params> greedy_optimize_from_random(int w, int h, int obstacles = 8, const bool verbose = false) {
-  const int RUNS = 10000;
-  Puzzle<Params> best(w,h);
-  int best_score = 0;
-  
-  for (int i=0; i < RUNS; ++i) {
-    // initialize
-    Puzzle<Params> puzzle(w,h);
-    for (int j=0; j < obstacles; ++j) {
-      puzzle[puzzle.random_coord()] = true;
-    }
-    puzzle.start = puzzle.random_empty_coord();
-    // optimize
-    puzzle = greedy_optimize(puzzle);
-    int score = max_distance(puzzle);
-    if (score > best_score) {
-      best_score = score;
-      best = puzzle;
-      if (verbose) show(best);
+void slide_table(Puzzle<Params> const& puzzle, SlideTable& table) {
+  using Coord = ::Coord<Params>;
+  const int n = puzzle.w * puzzle.h;
+  table.w = puzzle.w;
+  table.h = puzzle.h;
+  table.words = (n + 63) / 64;
+  table.obstacles.assign(n, false);
+  table.stops.assign(n * 4, SlideTable::NO_MOVE);
+  table.passes.assign(n * table.words, 0);
+  for (int cell = 0; cell < n; ++cell) {
+    Coord pos(cell % puzzle.w, cell / puzzle.w);
+    table.obstacles[cell] = puzzle[pos];
+    if (puzzle[pos]) continue;
+    uint64_t* passes = &table.passes[cell * table.words];
+    for (int dir = 0; dir < 4; ++dir) {
+      Coord stop = slide(puzzle, pos, dir, [&](Coord p) {
+        int c = p.col() + p.row() * puzzle.w;
+        passes[c / 64] |= uint64_t(1) << (c % 64);
+      });
+      if (stop != pos) {
+        table.stops[cell * 4 + dir] = stop.col() + stop.row() * puzzle.w;
+      } else if (!Params::EDGES_ARE_WALLS && !stops_at(puzzle, pos, dir)) {
+        table.stops[cell * 4 + dir] = SlideTable::OFF_EDGE;
+      }
     }
   }
-  return best;
 }
 
-// ----------------------------------------------------------------------------
-// Simulated annealing
-// ----------------------------------------------------------------------------
+struct AllPairs {
+  int w = 0, h = 0;
+  std::vector<int> scores;      // [start]: max_distance with this start, -1 for obstacles
+  std::vector<int> goals;       // [start]: the goal that find_goal would give, -1 for obstacles
+  std::vector<Distance> dists;  // [start*w*h + cell]: pass distances, if asked for
+  int best_score = -1;
+  int best_start = -1, best_goal = -1;
+  
+  // Combine the best pairs after computing ranges of starts separately
+  void update_best() {
+    for (int start = 0; start < (int)scores.size(); ++start) {
+      if (scores[start] > best_score) {
+        best_score = scores[start];
+        best_start = start;
+        best_goal = goals[start];
+      }
+    }
+  }
+};
 
-// Find and remove the i-th obstacle
-template <typename Params>
-void remove_obstacle(Puzzle<Params>& puzzle, int i) {
-  for (auto pos : puzzle) {
-    if (puzzle[pos]) {
-      if (i == 0) {
-        puzzle[pos] = false;
-        return;
+// Breadth first search from one start over the slide table. Returns the score, and sets goal to the
+// first cell (in row-major order) passed by the last move, like find_goal. Writes pass distances to row if given.
+inline int all_pairs_from(SlideTable const& table, int start, int& goal, Distance* row) {
+#ifdef BENCHMARK
+  solver_calls++;
+#endif
+  const int words = table.words;
+  thread_local std::vector<uint64_t> sets;
+  sets.assign(5 * words, 0);
+  uint64_t* visited = &sets[0];       // stop points
+  uint64_t* passed = &sets[words];
+  uint64_t* frontier = &sets[2 * words];
+  uint64_t* next = &sets[3 * words];
+  uint64_t* newly_passed = &sets[4 * words];
+  visited[start / 64] = passed[start / 64] = frontier[start / 64] = uint64_t(1) << (start % 64);
+  if (row) {
+    std::fill_n(row, table.w * table.h, UNREACHABLE);
+    row[start] = 0;
+  }
+  int score = 0;
+  goal = start;
+  bool more = true;
+  for (int dist = 1; more; ++dist) {
+    more = false;
+    std::fill_n(next, words, 0);
+    std::fill_n(newly_passed, words, 0);
+    for (int i = 0; i < words; ++i) {
+      for (uint64_t bits = frontier[i]; bits; bits &= bits - 1) {
+        int cell = i * 64 + __builtin_ctzll(bits);
+        uint64_t const* passes = table.passed_from(cell);
+        for (int j = 0; j < words; ++j) newly_passed[j] |= passes[j];
+        for (int dir = 0; dir < 4; ++dir) {
+          int stop = table.stops[cell * 4 + dir];
+          if (stop < 0 || (visited[stop / 64] >> (stop % 64) & 1)) continue;
+          visited[stop / 64] |= uint64_t(1) << (stop % 64);
+          next[stop / 64] |= uint64_t(1) << (stop % 64);
+          more = true;
+        }
       }
-      i--;
     }
+    bool any_passed = false;
+    for (int j = 0; j < words; ++j) {
+      uint64_t bits = newly_passed[j] & ~passed[j];
+      passed[j] |= bits;
+      if (bits && !any_passed) goal = j * 64 + __builtin_ctzll(bits);
+      any_passed |= bits != 0;
+      if (row) {
+        for (; bits; bits &= bits - 1) row[j * 64 + __builtin_ctzll(bits)] = dist;
+      }
+    }
+    if (any_passed) score = dist;
+    std::swap(frontier, next);
   }
+  return score;
 }
 
-template <typename Params>
-void random_change(Puzzle<Params>& puzzle, int num_obstacles) {
-  // move an obstacle or a the start location
-  int to_remove = random_range(num_obstacles+1);
-  if (to_remove == num_obstacles) {
-    puzzle.start = puzzle.random_empty_coord();
-  } else {
-    remove_obstacle(puzzle, to_remove);
-    puzzle[puzzle.random_empty_coord()] = true;
+// Scores (and distances, if result.dists is sized w*h*w*h) for the starts in [first, last).
+// Doesn't update the best pair.
+inline void all_pairs_range(SlideTable const& table, int first, int last, AllPairs& result) {
+  const int n = table.w * table.h;
+  bool with_dists = result.dists.size() == (size_t)n * n;
+  for (int start = first; start < last; ++start) {
+    if (table.obstacles[start]) {
+      result.scores[start] = result.goals[start] = -1;
+      if (with_dists) std::fill_n(&result.dists[(size_t)start * n], n, UNREACHABLE);
+      continue;
+    }
+    result.scores[start] = all_pairs_from(table, start, result.goals[start], with_dists ? &result.dists[(size_t)start * n] : nullptr);
   }
 }
 
+inline void all_pairs_init(SlideTable const& table, bool with_dists, AllPairs& result) {
+  const int n = table.w * table.h;
+  result.w = table.w;
+  result.h = table.h;
+  result.scores.assign(n, -1);
+  result.goals.assign(n, -1);
+  result.dists.assign(with_dists ? (size_t)n * n : 0, UNREACHABLE);
+  result.best_score = result.best_start = result.best_goal = -1;
+}
+
+// All starts on the calling thread. all_pairs_parallel (see Thread pool) splits them over threads.
 template <typename Params>
-Puzzle<Params> make_random_puzzle(int w, int h, int obstacles) {
-  Puzzle<Params> puzzle(w,h);
-  puzzle.start = puzzle.random_coord();
-  for (int i = 0; i < obstacles; ++i) {
-    puzzle[puzzle.random_empty_coord()] = true;
+void all_pairs(Puzzle<Params> const& puzzle, bool with_dists, AllPairs& result) {
+  thread_local SlideTable table;
+  slide_table(puzzle, table);
+  all_pairs_init(table, with_dists, result);
+  all_pairs_range(table, 0, puzzle.w * puzzle.h, result);
+  result.update_best();
+}
+
+// ----------------------------------------------------------------------------
+// Replaying solutions
+// ----------------------------------------------------------------------------
+
+// Check submitted solutions (strings of L, R, U, D) of one puzzle, using its slide table,
+// so each move is a table lookup. A solution must pass the goal with its last move.
+
+enum class ReplayStatus {
+  OK,
+  BAD_LETTER,       // not one of L, R, U, D
+  BLOCKED,          // a move that doesn't move
+  OFF_EDGE,         // a move that slides off the edge (without walls), without passing the goal
+  GOAL_NOT_REACHED, // all moves are fine, but none passes the goal
+  MOVES_AFTER_GOAL  // the goal was passed before the last move
+};
+
+const char* replay_status_name(ReplayStatus status) {
+  switch (status) {
+    case ReplayStatus::OK:               return "ok";
+    case ReplayStatus::BAD_LETTER:       return "bad-letter";
+    case ReplayStatus::BLOCKED:          return "blocked";
+    case ReplayStatus::OFF_EDGE:         return "off-edge";
+    case ReplayStatus::GOAL_NOT_REACHED: return "goal-not-reached";
+    case ReplayStatus::MOVES_AFTER_GOAL: return "moves-after-goal";
   }
-  return puzzle;
+  return "?";
 }
 
-template <typename Params>
-Puzzle<Params> simulated_annealing_search(int w, int h, int obstacles, int verbose=0) {
-  Puzzle<Params> best(w,h);
-  int best_score = 0;
+struct Replay {
+  ReplayStatus status;
+  int moves; // the number of moves for OK, otherwise the index of the offending move
+};
 
-  const int RUNS = 10;
-  const int STEP_PER_TEMPERATURE = 100 * obstacles;
-  const double TEMPERATURE_INITIAL = 0.1;
-  const double TEMPERATURE_FINAL = 1e-5;
-  const double TEMPERATURE_STEP = 1 / 1.003;
+// Replays solutions of one puzzle. Each move is a lookup in the puzzle's slide table,
+// so checking a solution is much cheaper than solving the puzzle.
+class SolutionChecker {
+public:
+  template <typename Params>
+  SolutionChecker(Puzzle<Params> const& puzzle, Coord<Params> goal) {
+    slide_table(puzzle, table);
+    start = puzzle.start.col() + puzzle.start.row() * puzzle.w;
+    this->goal = goal.col() + goal.row() * puzzle.w;
+    passes_goal.assign(puzzle.w * puzzle.h, 0);
+    if (!puzzle[goal]) {
+      goal_predecessors(puzzle, goal, [&](Coord<Params> p, int dir) {
+        passes_goal[p.col() + p.row() * puzzle.w] |= 1 << dir;
+      });
+    }
+    std::fill_n(letter_dirs, 256, -1);
+    for (int dir = 0; dir < 4; ++dir) {
+      letter_dirs[(uint8_t)DIRECTION_LETTERS[dir]] = dir;
+      letter_dirs[(uint8_t)tolower(DIRECTION_LETTERS[dir])] = dir;
+    }
+  }
   
-  for (int i=0; i < RUNS; ++i) {
-    auto puzzle = make_random_puzzle<Params>(w,h,obstacles);
-    int score = max_distance(puzzle);
-    for (double temp = TEMPERATURE_INITIAL; temp >= TEMPERATURE_FINAL; temp *= TEMPERATURE_STEP) {
-      int n_accept = 0, n_reject = 0;
-      for (int i=0; i < STEP_PER_TEMPERATURE; ++i) {
-        // change
-        auto prev_puzzle = puzzle;
-        int prev_score = score;
-        random_change(puzzle, obstacles);
-        // compare with best
-        score = max_distance(puzzle);
-        if (score > best_score) {
-          best_score = score;
-          best = puzzle;
-          if (verbose) show(best);
-        }
-        // compare with previous
-        bool accept = random_double() < exp(temp * (score - prev_score));
-        if (!accept) {
-          n_accept++;
-          score = prev_score;
-          puzzle = prev_puzzle;
-        } else {
-          n_reject++;
-        }
-      }
-      if (verbose >= 2) {
-        std::cout << "at " << temp << "  " << (double)n_accept/n_reject << " accepted" << std::endl;
-      }
+  Replay check(const char* moves, int length) const {
+    if (start == goal) return {length == 0 ? ReplayStatus::OK : ReplayStatus::MOVES_AFTER_GOAL, 0};
+    int pos = start;
+    for (int i = 0; i < length; ++i) {
+      int dir = letter_dirs[(uint8_t)moves[i]];
+      if (dir < 0) return {ReplayStatus::BAD_LETTER, i};
+      // a move off the edge still passes the cells on its way, as in max_distance
+      if (passes_goal[pos] >> dir & 1) return {i == length-1 ? ReplayStatus::OK : ReplayStatus::MOVES_AFTER_GOAL, i+1};
+      int stop = table.stops[pos * 4 + dir];
+      if (stop < 0) return {stop == SlideTable::OFF_EDGE ? ReplayStatus::OFF_EDGE : ReplayStatus::BLOCKED, i};
+      pos = stop;
     }
+    return {ReplayStatus::GOAL_NOT_REACHED, length};
   }
-  return best;
-}
+  
+private:
+  SlideTable table;
+  int start, goal;
+  std::vector<uint8_t> passes_goal; // [cell]: a bit for each direction whose move passes the goal
+  int8_t letter_dirs[256];
+};
 
 // ----------------------------------------------------------------------------
-// Exhaustive search
+// Histograms
 // ----------------------------------------------------------------------------
 
-template <typename Params>
-struct SkipStartIterator {
-  using base_iterator = typename Puzzle<Params>::iterator;
-  base_iterator it;
-  int start;
-  explicit SkipStartIterator(Puzzle<Params> const& p)
-    : it(p.begin()), start(p.start)
-  {
-    if (*it == start) ++it;
+// Distribution of scores and of the number of reachable cells, over all puzzles that a search solves.
+// A puzzle can count for several, exhaustive searches weight each puzzle by the number of mirror images of its start.
+// Each thread fills its own histogram, they are merged at the end.
+struct ScoreHistogram {
+  std::vector<uint64_t> scores;
+  std::vector<uint64_t> reachable;
+
+  // call right after max_distance
+  inline void add(int score, uint64_t weight = 1) {
+    add(scores, score, weight);
+    add(reachable, reachable_cells, weight);
   }
-  void operator ++ () {
-    ++it;
-    if (*it == start) ++it;
+  void merge(ScoreHistogram const& that) {
+    for (size_t i = 0; i < that.scores.size(); ++i) add(scores, (int)i, that.scores[i]);
+    for (size_t i = 0; i < that.reachable.size(); ++i) add(reachable, (int)i, that.reachable[i]);
   }
-  Coord<Params> operator * () const {
-    return *it;
+  uint64_t total() const {
+    uint64_t sum = 0;
+    for (auto x : scores) sum += x;
+    return sum;
   }
-  bool operator == (base_iterator const& that) const {
-    return it == that;
+
+  // CSV lines "label,kind,value,count", without a header
+  void write_csv(std::ostream& out, int label) const {
+    for (size_t i = 0; i < scores.size(); ++i) {
+      if (scores[i]) out << label << ",score," << i << "," << scores[i] << "\n";
+    }
+    for (size_t i = 0; i < reachable.size(); ++i) {
+      if (reachable[i]) out << label << ",reachable," << i << "," << reachable[i] << "\n";
+    }
   }
-  bool operator != (base_iterator const& that) const {
-    return it != that;
+  void write_json(std::ostream& out) const {
+    auto array = [&](std::vector<uint64_t> const& xs) {
+      out << "[";
+      for (size_t i = 0; i < xs.size(); ++i) out << (i ? "," : "") << xs[i];
+      out << "]";
+    };
+    out << "{\"score\":";
+    array(scores);
+    out << ",\"reachable\":";
+    array(reachable);
+    out << "}";
+  }
+
+private:
+  static inline void add(std::vector<uint64_t>& xs, int i, uint64_t count = 1) {
+    if ((int)xs.size() <= i) xs.resize(i+1, 0);
+    xs[i] += count;
   }
 };
 
-// move obstacles to next configuration
-// in (reversed) lexicographical order
-template <typename Params>
-bool next_puzzle(Puzzle<Params>& p) {
-  // change "0001110" to "1100001"
-  // find obstacle
-  auto obstacle = SkipStartIterator<Params>(p);
-  while (true) {
-    if (obstacle == p.end()) return false; // no obstacles
-    if (p[*obstacle]) break;
-    ++obstacle;
+// ----------------------------------------------------------------------------
+// Generators
+// ----------------------------------------------------------------------------
+
+// A lazy sequence of values, produced by a coroutine.
+// The coroutine yields references to its own state (usually a puzzle that it modifies in place),
+// so there is no allocation per item. A yielded value is only valid until the next item is requested.
+// Generators are input ranges, so they can be combined with std::views (filter, take, ...)
+template <typename T>
+class Generator {
+public:
+  struct promise_type {
+    T const* current = nullptr;
+    Generator get_return_object() {
+      return Generator(Handle::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(T const& value) noexcept {
+      current = &value;
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { throw; }
+  };
+  using Handle = std::coroutine_handle<promise_type>;
+
+  struct iterator {
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    Handle handle;
+    iterator& operator ++ () {
+      handle.resume();
+      return *this;
+    }
+    void operator ++ (int) {
+      handle.resume();
+    }
+    T const& operator * () const {
+      return *handle.promise().current;
+    }
+    bool operator == (std::default_sentinel_t) const {
+      return handle.done();
+    }
+  };
+
+  explicit Generator(Handle handle) : handle(handle) {}
+  Generator(Generator&& that) : handle(that.handle) {
+    that.handle = nullptr;
   }
-  // find clear space after obstacles
-  int num_obstacles = 0;
-  auto first_clear = obstacle;
-  while (true) {
-    if (first_clear == p.end()) return false; // last puzzle in ordering
-    if (!p[*first_clear]) break;
-    ++first_clear;
-    ++num_obstacles;
+  Generator& operator = (Generator&& that) {
+    std::swap(handle, that.handle);
+    return *this;
   }
-  // move over
-  auto it = SkipStartIterator<Params>(p);
-  for (int i=0; i<num_obstacles-1; ++i) {
-    p[*obstacle] = false;
-    p[*it] = true;
-    ++obstacle;
-    ++it;
+  ~Generator() {
+    if (handle) handle.destroy();
   }
-  p[*obstacle] = false;
-  p[*first_clear] = true;
-  return true;
+
+  iterator begin() {
+    handle.resume();
+    return iterator{handle};
+  }
+  std::default_sentinel_t end() {
+    return {};
+  }
+
+private:
+  Handle handle;
+};
+
+// ----------------------------------------------------------------------------
+// Hall of fame
+// ----------------------------------------------------------------------------
+
+inline uint64_t mix_hash(uint64_t x) {
+  // splitmix64 finalizer
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
 }
 
-// first puzzle configuration
+// Hash of a puzzle that is the same for all its mirror images, and for transpositions of square puzzles.
+// We hash each symmetric image of the puzzle, and take the smallest hash.
 template <typename Params>
-void first_puzzle(Puzzle<Params>& p, int obstacles) {
-  p.clear();
-  auto it = SkipStartIterator<Params>(p);
-  while (obstacles > 0 && it != p.end()) {
-    p[*it] = true;
-    --obstacles;
-    ++it;
+uint64_t canonical_hash(Puzzle<Params> const& puzzle) {
+  const int w = puzzle.w, h = puzzle.h;
+  const int num_images = w == h ? 8 : 4;
+  const uint64_t START = 0x5354415254ull;
+  uint64_t hashes[8] = {};
+  auto add = [&](int x, int y, uint64_t salt) {
+    for (int t = 0; t < num_images; ++t) {
+      int tx = t & 1 ? w-1-x : x;
+      int ty = t & 2 ? h-1-y : y;
+      if (t & 4) std::swap(tx, ty);
+      // a sum is independent of the order of the obstacles
+      hashes[t] += mix_hash((uint64_t)(tx + ty * w) ^ salt);
+    }
+  };
+  for (auto pos : puzzle) {
+    if (puzzle[pos]) add(pos.col(), pos.row(), 0);
   }
+  add(puzzle.start.col(), puzzle.start.row(), START);
+  return *std::min_element(hashes, hashes + num_images) ^ mix_hash((uint64_t)w << 32 | h);
 }
 
+// The best K distinct puzzles, or all optimal puzzles (up to K), for one configuration.
+// Puzzles that are mirror images of each other are only stored once.
+// Can be used from multiple threads. Most candidates score too low,
+// they are rejected by comparing with an atomic threshold, without taking the lock.
 template <typename Params>
-Puzzle<Params> brute_force_search(int w, int h, int obstacles = 8, const bool verbose = false) {
-  Puzzle<Params> best(w,h);
-  int best_score = -1;
-  
-  Puzzle<Params> puzzle(w,h);
-  for (auto start_coord : puzzle) {
-    // By mirror symmetry, we only need to consider start coordinates in top-left quadrant
-    // If w==h, by transposition we only need the upper diagonal
-    if (start_coord.col()*2 > w || start_coord.row()*2 > h || (w == h && start_coord.row() > start_coord.col())) {
-      if (verbose) std::cout << "Skip " << start_coord << " (" << start_coord.col() << "," << start_coord.row() << ")" << std::endl;
-      continue;
+class HallOfFame {
+public:
+  struct Entry {
+    int score;
+    uint64_t hash;
+    Puzzle<Params> puzzle;
+  };
+
+  explicit HallOfFame(size_t capacity, bool all_optima = false)
+    : capacity(capacity), all_optima(all_optima) {}
+
+  void offer(Puzzle<Params> const& puzzle, int score) {
+    if (score < threshold.load(std::memory_order_relaxed)) return;
+    uint64_t hash = canonical_hash(puzzle);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (score < threshold.load(std::memory_order_relaxed)) return;
+    if (all_optima && !entries.empty() && score > entries[0].score) {
+      entries.clear();
+      hashes.clear();
+      dropped = 0;
     }
-    puzzle.start = start_coord;
-    first_puzzle(puzzle, obstacles);
-    if (verbose) std::cout << "Start " << start_coord << " (" << start_coord.col() << "," << start_coord.row() << ")" << std::endl;
-    while (true) {
-      int score = max_distance(puzzle);
-      if (score > best_score) {
-        best_score = score;
-        best = puzzle;
-        if (verbose) show(best);
+    if (hashes.count(hash)) return;
+    if (entries.size() >= capacity) {
+      if (all_optima) {
+        dropped++;
+        return;
       }
-      if (!next_puzzle(puzzle)) break;
+      // replace the lowest scoring puzzle
+      std::pop_heap(entries.begin(), entries.end(), lower_score);
+      hashes.erase(entries.back().hash);
+      entries.pop_back();
+    }
+    entries.push_back(Entry{score, hash, puzzle});
+    hashes.insert(hash);
+    if (all_optima) {
+      threshold = score;
+    } else {
+      std::push_heap(entries.begin(), entries.end(), lower_score);
+      if (entries.size() >= capacity) threshold = entries.front().score + 1;
     }
   }
-  return best;
+
+  // entries with the highest score first
+  std::vector<Entry> sorted() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Entry> out = entries;
+    std::stable_sort(out.begin(), out.end(), [](Entry const& a, Entry const& b) { return a.score > b.score; });
+    return out;
+  }
+
+  // number of optimal puzzles that didn't fit
+  size_t num_dropped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped;
+  }
+
+  void show_all(std::ostream& out = std::cout, bool ansi_color = true) const {
+    auto all = sorted();
+    for (auto const& entry : all) {
+      show(entry.puzzle, Style::BOX_DRAWING, ansi_color, out);
+    }
+    if (size_t n = num_dropped()) out << n << " more optimal puzzles not stored" << std::endl;
+  }
+
+private:
+  static bool lower_score(Entry const& a, Entry const& b) {
+    return a.score > b.score; // min-heap on score
+  }
+  size_t capacity;
+  bool all_optima;
+  mutable std::mutex mutex;
+  std::vector<Entry> entries; // heap with the lowest score at the front, unless all_optima
+  std::unordered_set<uint64_t> hashes;
+  size_t dropped = 0;
+  std::atomic<int> threshold{0};
+};
+
+#ifdef BENCHMARK
+// Thrown to end a search early
+struct SearchStopped {};
+
+// Watches the scores of all puzzles that a search on this thread looks at,
+// and stops the search once it reaches the target score or the deadline has passed.
+struct SearchProbe {
+  int target;
+  std::chrono::steady_clock::time_point deadline;
+  int best_score = -1;
+  long long seen = 0;
+  
+  void observe(int score) {
+    if (score > best_score) {
+      best_score = score;
+      if (score >= target) throw SearchStopped();
+    }
+    // reading the clock is not free, so only check it once in a while
+    if (++seen % 1024 == 0 && std::chrono::steady_clock::now() > deadline) throw SearchStopped();
+  }
+};
+thread_local SearchProbe* search_probe = nullptr;
+#endif
+
+template <typename Params>
+inline void offer(HallOfFame<Params>* hall, Puzzle<Params> const& puzzle, int score) {
+  if (hall) hall->offer(puzzle, score);
+#ifdef BENCHMARK
+  if (search_probe) search_probe->observe(score);
+#endif
 }
 
 // ----------------------------------------------------------------------------
-// Relative position based puzzle
+// Lock-free queue
 // ----------------------------------------------------------------------------
 
-enum class RelativePosition {
-  SAME,
-  NEXT,
-  SKIP,
+// Bounded lock-free multi-producer multi-consumer queue.
+// Each cell has a sequence number that tells whether it is ready to be written or read,
+// see Dmitry Vyukov's bounded MPMC queue.
+template <typename T>
+class RingBuffer {
+public:
+  // capacity must be a power of two
+  explicit RingBuffer(size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1) {
+    assert((capacity & mask) == 0);
+    for (size_t i = 0; i < capacity; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool try_push(T const& value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[pos & mask];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false; // full
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  bool try_pop(T& value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[pos & mask];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          value = cell.value;
+          cell.sequence.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false; // empty
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Blocking versions. Waiting on a full queue gives backpressure to the producers.
+  void push(T const& value) {
+    while (!try_push(value)) std::this_thread::yield();
+  }
+  void pop(T& value) {
+    while (!try_pop(value)) std::this_thread::yield();
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
 };
 
-// A puzzle where obstacles are placed relative to each other
-// Obstacles and start location are placed from left to right
-// vertical positions are placed top to bottom, and we use a permutation to pick a vertical location
-//
-// We have num_objects-1 obstacles and 1 start location.
-// There are num_objects+1 horizontal and vertical relative positions (between walls and objects)
-template <int MAX_OBSTACLES = 64>
-struct RelativePuzzle {
-  int num_objects;
-  RelativePosition horizontal_pos[MAX_OBSTACLES];
-  RelativePosition vertical_pos[MAX_OBSTACLES];
-  int permutation[MAX_OBSTACLES];
-  int start_index;
+// ----------------------------------------------------------------------------
+// Convergence telemetry
+// ----------------------------------------------------------------------------
 
-  // require:
-  //   * with o obstacles, have o+1 objects, o+2 relative positions
-  //   * // don't overlap wall
-  //     horizontal_pos[0] != SAME && horizontal_pos[o+1] != SAME
-  //     vertical_pos[0] != SAME && vertical_pos[o+1] != SAME
-  //   * if horizontal_pos[i] == SAME, then
-  //       not all j in perm[i]..perm[i+1] have vertical_pos[j] == SAME
-  //       permutation[i] < permutation[i+1]
-  //   * for uniqueness: permutation[0] <= n/2
-  //       otherwise we could vertical flip
-  //   * for uniqueness: start_index <= n/2
-  //       otherwise we could horizontal flip
+// With --convergence FILE, the stochastic searches (greedy and simulated annealing) report their progress
+// at a fixed interval: elapsed time, solver calls, current and best score, and the fraction of accepted changes.
+// Searches only push samples to a queue, a background thread writes them as CSV.
+struct ConvergenceSample {
+  const char* strategy; // nullptr tells the writer to stop
+  int search;           // id of the search, several can run at the same time
+  int obstacles;
+  int run;              // restart within the search
+  double seconds;       // since the search started
+  long long solver_calls;
+  int score;
+  int best_score;
+  double acceptance;    // accepted changes / tried changes since the previous sample
+};
+
+class ConvergenceLog {
+public:
+  ConvergenceLog(std::ostream& out, double interval) : interval(interval), samples(4096), out(out) {
+    out << "strategy,search,obstacles,run,seconds,solver_calls,score,best_score,acceptance_rate\n";
+    writer = std::thread([this]{ write_samples(); });
+  }
+  ~ConvergenceLog() {
+    ConvergenceSample stop{};
+    samples.push(stop);
+    writer.join();
+    if (dropped > 0) std::cerr << dropped << " convergence samples dropped" << std::endl;
+  }
   
-  static void to_coords(const RelativePosition* rel_pos, int n, int* coords, int& w) {
-    int x = -1;
-    for (int i=0; i<n+1; ++i) {
-      if      (rel_pos[i] == RelativePosition::SAME) x += 0;
-      else if (rel_pos[i] == RelativePosition::NEXT) x += 1;
-      else if (rel_pos[i] == RelativePosition::SKIP) x += 4;
-      coords[i] = x;
+  const double interval; // seconds between samples of a search
+  std::atomic<int> next_search{0};
+  
+  // Never blocks the search: if the writer can't keep up, samples are dropped
+  void add(ConvergenceSample const& sample) {
+    if (!samples.try_push(sample)) dropped++;
+  }
+  
+private:
+  RingBuffer<ConvergenceSample> samples;
+  std::ostream& out;
+  std::thread writer;
+  std::atomic<long long> dropped{0};
+  
+  void write_samples() {
+    char line[256];
+    while (true) {
+      ConvergenceSample sample;
+      if (!samples.try_pop(sample)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      if (!sample.strategy) break;
+      snprintf(line, sizeof(line), "%s,%d,%d,%d,%.6f,%lld,%d,%d,%.4f\n", sample.strategy, sample.search, sample.obstacles,
+               sample.run, sample.seconds, sample.solver_calls, sample.score, sample.best_score, sample.acceptance);
+      out << line;
     }
-    w = coords[n];
+    out.flush();
+  }
+};
+ConvergenceLog* convergence_log = nullptr;
+
+// Progress of one search, sampled into the convergence log
+class ConvergenceTracker {
+public:
+  ConvergenceTracker(const char* strategy, int obstacles) : strategy(strategy), obstacles(obstacles) {
+    if (convergence_log) {
+      search = convergence_log->next_search++;
+      start = std::chrono::steady_clock::now();
+      next_sample = convergence_log->interval;
+    }
+  }
+  ~ConvergenceTracker() {
+    if (convergence_log && solver_calls > 0) sample(elapsed());
   }
   
-  template <typename Params>
-  bool to_puzzle(Puzzle<Params>& puzzle) const {
-    int x_coords[MAX_OBSTACLES];
-    int y_coords[MAX_OBSTACLES];
-    to_coords(horizontal_pos, num_objects, x_coords, puzzle.w);
-    to_coords(vertical_pos, num_objects, y_coords, puzzle.h);
-    if (puzzle.w == 0 || puzzle.w > Params::MAX_W-1 || x_coords[0] == -1) return false;
-    if (puzzle.h == 0 || puzzle.h > Params::MAX_H   || y_coords[0] == -1) return false;
-    puzzle.clear();
-    for (int i=0; i<num_objects; ++i) {
-      auto pos = Coord<Params>(x_coords[i], y_coords[permutation[i]]);
-      if (i == start_index) {
-        puzzle.start = pos;
-      } else {
-        puzzle[pos] = true;
+  void restart(int new_run) {
+    run = new_run;
+  }
+  // Call after each call of the solver
+  inline void solved() {
+    solver_calls++;
+  }
+  // Call for each puzzle the search considers, with its score, whether the search moved to it,
+  // and the score of the puzzle the search is at now
+  inline void step(int score, bool accepted, int current) {
+    if (!convergence_log) return;
+    steps++;
+    tried++;
+    if (accepted) this->accepted++;
+    current_score = current;
+    best_score = std::max(best_score, score);
+    // reading the clock for every step would be noticeable, so only check it once in a while
+    if (steps % 64 == 0) {
+      double seconds = elapsed();
+      if (seconds >= next_sample) {
+        sample(seconds);
+        next_sample = seconds + convergence_log->interval;
       }
     }
-    return true;
+  }
+  
+private:
+  const char* strategy;
+  int obstacles;
+  int search = 0;
+  int run = 0;
+  std::chrono::steady_clock::time_point start;
+  double next_sample = 0;
+  long long solver_calls = 0, steps = 0;
+  long long tried = 0, accepted = 0;
+  int current_score = 0, best_score = 0;
+  
+  double elapsed() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  void sample(double seconds) {
+    convergence_log->add(ConvergenceSample{strategy, search, obstacles, run, seconds, solver_calls,
+                                           current_score, best_score, tried ? (double)accepted / tried : 0.0});
+    tried = accepted = 0;
   }
 };
 
-RelativePuzzle<> first_relative_puzzle(int obstacles, bool allow_same) {
-  RelativePuzzle<> p;
-  p.num_objects = obstacles + 1;
-  p.start_index = 0;
-  for (int i = 0; i < p.num_objects+1; ++i) {
-    auto pos = i == 0 || i == p.num_objects || !allow_same ? RelativePosition::NEXT : RelativePosition::SAME;
-    p.horizontal_pos[i] = pos;
-    p.vertical_pos[i] = pos;
+// ----------------------------------------------------------------------------
+// Greedy puzzle maker
+// ----------------------------------------------------------------------------
+
+// All puzzles that differ from the given one by moving a single obstacle or (optionally) the start,
+// or optionally by swapping two rows or columns
+template <typename Params>
+Generator<Puzzle<Params>> single_changes(Puzzle<Params> puzzle, bool swaps, bool reachable_only, bool start_moves = true) {
+  using Coord = ::Coord<Params>;
+  // find out which cells are reachable
+  Distance reachable[Params::BUFFER_SIZE];
+  if (reachable_only) {
+    max_distance(puzzle);
+    std::copy(pass_dists, pass_dists+Params::ROW_STRIDE*puzzle.h, reachable);
+  }
+  // for each obstacle, consider moving it to any location, and call fun
+  auto puzzle_new = puzzle;
+  for (auto obstacle : puzzle) {
+    if (puzzle[obstacle]) {
+      puzzle_new.set(obstacle, false);
+      for (auto alt : puzzle) {
+        if (reachable_only && reachable[alt] == UNREACHABLE) {
+          // optimization: no path reaches this cell, so placing an obstacle here is useless
+          continue;
+        }
+        if (!puzzle[alt] && alt != puzzle.start) {
+          puzzle_new.set(alt, true);
+          count_stat(NEIGHBOURS);
+          co_yield puzzle_new;
+          puzzle_new.set(alt, false);
+        }
+      }
+      puzzle_new.set(obstacle, true);
+    }
+  }
+  // consider new start location
+  if (start_moves) {
+    for (auto alt : puzzle) {
+      if (!puzzle[alt] && alt != puzzle.start) {
+        puzzle_new.start = alt;
+        count_stat(NEIGHBOURS);
+        co_yield puzzle_new;
+      }
+    }
+  }
+  // swap rows/columns
+  if (swaps) {
+    for (int x1 = 0; x1 < puzzle.w; ++x1) {
+      for (int x2 = x1+1; x2 < puzzle.w; ++x2) {
+        puzzle_new = puzzle;
+        for (int y = 0; y < puzzle.h; ++y) {
+          puzzle_new.set(Coord(x1,y), puzzle[Coord(x2,y)]);
+          puzzle_new.set(Coord(x2,y), puzzle[Coord(x1,y)]);
+        }
+        if (puzzle.start.col() == x1) {
+          puzzle_new.start = Coord(x2, puzzle.start.row());
+        } else if (puzzle.start.col() == x2) {
+          puzzle_new.start = Coord(x1, puzzle.start.row());
+        }
+        count_stat(NEIGHBOURS);
+        co_yield puzzle_new;
+      }
+    }
+    for (int y1 = 0; y1 < puzzle.h; ++y1) {
+      for (int y2 = y1+1; y2 < puzzle.h; ++y2) {
+        puzzle_new = puzzle;
+        for (int x = 0; x < puzzle.w; ++x) {
+          puzzle_new.set(Coord(x,y1), puzzle[Coord(x,y2)]);
+          puzzle_new.set(Coord(x,y2), puzzle[Coord(x,y1)]);
+        }
+        if (puzzle.start.row() == y1) {
+          puzzle_new.start = Coord(puzzle.start.col(), y2);
+        } else if (puzzle.start.row() == y2) {
+          puzzle_new.start = Coord(puzzle.start.col(), y1);
+        }
+        count_stat(NEIGHBOURS);
+        co_yield puzzle_new;
+      }
+    }
+  }
+}
+
+template <typename Params, typename F>
+void for_single_changes(Puzzle<Params> const& puzzle, bool swaps, bool reachable_only, F fun, bool start_moves = true) {
+  auto changes = single_changes(puzzle, swaps, reachable_only, start_moves);
+  for (auto it = changes.begin(); it != changes.end(); ) {
+    fun(*it);
+    PerfPhase perf(PHASE_MOVES);
+    ++it;
+  }
+}
+
+template <typename Params>
+Puzzle<Params> greedy_optimize(Puzzle<Params> const& initial, bool verbose = false, HallOfFame<Params>* hall = nullptr,
+                               ConvergenceTracker* tracker = nullptr) {
+  auto best = initial;
+  int best_score = max_distance(best);
+  if (tracker) tracker->solved();
+  offer(hall, best, best_score);
+  if (tracker) tracker->step(best_score, true, best_score);
+  const bool accept_same_score = false;
+  const int BUDGET = accept_same_score ? 10 : 1;
+  const bool USE_SWAPS = false;
+  const bool REACHABLE_ONLY = true;
+  int budget = BUDGET;
+  AllPairs start_scores;
+  
+  while (budget > 0) {
+    budget--;
+    auto cur = best;
+    int num_equiv = 1; // number of puzzles with the same score as best
+    bool swaps = USE_SWAPS && (budget == BUDGET || budget == 0);
+    auto consider = [&](Puzzle<Params> const& p, int score) {
+      offer(hall, p, score);
+      if (tracker) tracker->step(score, score > best_score, std::max(score, best_score));
+      if (score > best_score) {
+        best = p;
+        best_score = score;
+        budget = BUDGET;
+        count_stat(NEIGHBOURS_IMPROVED);
+        if (verbose) {
+          show(best);
+          std::cout << std::endl;
+        }
+      } else if (accept_same_score && score == best_score) {
+        num_equiv++;
+        // accept with probability 1/num_equiv
+        if (random_range(num_equiv) == 0) {
+          best = p;
+        }
+      }
+    };
+    for_single_changes(cur, swaps, REACHABLE_ONLY, [&](Puzzle<Params> const& p) {
+      int score = max_distance(p);
+      if (tracker) tracker->solved();
+      consider(p, score);
+    }, false);
+    // moving the start: the scores of all starts at once, in one call of the solver
+    all_pairs(cur, false, start_scores);
+    if (tracker) tracker->solved();
+    auto p = cur;
+    for (auto alt : cur) {
+      if (!cur[alt] && alt != cur.start) {
+        p.start = alt;
+        count_stat(NEIGHBOURS);
+        consider(p, start_scores.scores[alt.col() + alt.row() * cur.w]);
+      }
+    }
+  }
+  return best;
+}
+
+const int GREEDY_RUNS = 10000;
+
+template <typename Params>
+Puzzle<Params> greedy_optimize_from_random(int w, int h, int obstacles = 8, const bool verbose = false, int runs = GREEDY_RUNS, HallOfFame<Params>* hall = nullptr) {
+  Puzzle<Params> best(w,h);
+  int best_score = 0;
+  ConvergenceTracker tracker("greedy", obstacles);
+  
+  for (int i=0; i < runs; ++i) {
+    TraceSpan span("greedy restart", "run", i);
+    tracker.restart(i);
+    // initialize
+    Puzzle<Params> puzzle(w,h);
+    for (int j=0; j < obstacles; ++j) {
+      puzzle.set(puzzle.random_coord(), true);
+    }
+    // the default start can be the only empty cell left
+    if (puzzle.count_obstacles() + 1 < w * h || puzzle[puzzle.start]) {
+      puzzle.start = puzzle.random_empty_coord();
+    }
+    // optimize
+    puzzle = greedy_optimize(puzzle, false, hall, &tracker);
+    count_stat(GREEDY_RUNS_DONE);
+    int score = max_distance(puzzle);
+    tracker.solved();
+    if (score > best_score) {
+      best_score = score;
+      best = puzzle;
+      if (verbose) show(best);
+    }
+  }
+  return best;
+}
+
+// ----------------------------------------------------------------------------
+// Simulated annealing
+// ----------------------------------------------------------------------------
+
+// Find and remove the i-th obstacle
+template <typename Params>
+void remove_obstacle(Puzzle<Params>& puzzle, int i) {
+  for (auto pos : puzzle) {
+    if (puzzle[pos]) {
+      if (i == 0) {
+        puzzle.set(pos, false);
+        return;
+      }
+      i--;
+    }
+  }
+}
+
+template <typename Params>
+void random_change(Puzzle<Params>& puzzle, int num_obstacles) {
+  PerfPhase perf(PHASE_MOVES);
+  // move an obstacle or a the start location
+  int to_remove = random_range(num_obstacles+1);
+  if (to_remove == num_obstacles) {
+    if (num_obstacles + 1 >= puzzle.w * puzzle.h) return; // no empty cell for the start
+    puzzle.start = puzzle.random_empty_coord();
+  } else {
+    remove_obstacle(puzzle, to_remove);
+    puzzle.set(puzzle.random_empty_coord(), true);
+  }
+}
+
+template <typename Params>
+Puzzle<Params> make_random_puzzle(int w, int h, int obstacles) {
+  Puzzle<Params> puzzle(w,h);
+  puzzle.start = puzzle.random_coord();
+  for (int i = 0; i < obstacles; ++i) {
+    puzzle.set(puzzle.random_empty_coord(), true);
+  }
+  return puzzle;
+}
+
+const int ANNEALING_RUNS = 10;
+
+template <typename Params>
+Puzzle<Params> simulated_annealing_search(int w, int h, int obstacles, int verbose=0, int runs = ANNEALING_RUNS, HallOfFame<Params>* hall = nullptr) {
+  Puzzle<Params> best(w,h);
+  int best_score = 0;
+
+  const int STEP_PER_TEMPERATURE = 100 * obstacles;
+  const double TEMPERATURE_INITIAL = 0.1;
+  const double TEMPERATURE_FINAL = 1e-5;
+  const double TEMPERATURE_STEP = 1 / 1.003;
+  
+  ConvergenceTracker tracker("annealing", obstacles);
+  for (int i=0; i < runs; ++i) {
+    TraceSpan span("annealing restart", "run", i);
+    tracker.restart(i);
+    auto puzzle = make_random_puzzle<Params>(w,h,obstacles);
+    int score = max_distance(puzzle);
+    tracker.solved();
+    for (double temp = TEMPERATURE_INITIAL; temp >= TEMPERATURE_FINAL; temp *= TEMPERATURE_STEP) {
+      TraceSpan level("temperature", "temperature", temp);
+      int n_accept = 0, n_reject = 0;
+      for (int i=0; i < STEP_PER_TEMPERATURE; ++i) {
+        // change
+        auto prev_puzzle = puzzle;
+        int prev_score = score;
+        random_change(puzzle, obstacles);
+        count_stat(ANNEALING_STEPS);
+        // compare with best
+        score = max_distance(puzzle);
+        tracker.solved();
+        offer(hall, puzzle, score);
+        if (score > best_score) {
+          best_score = score;
+          best = puzzle;
+          if (verbose) show(best);
+        }
+        // compare with previous
+        bool accept = random_double() < exp(temp * (score - prev_score));
+        int new_score = score;
+        if (!accept) {
+          n_accept++;
+          score = prev_score;
+          puzzle = prev_puzzle;
+        } else {
+          n_reject++;
+          count_stat(ANNEALING_ACCEPTED);
+        }
+        tracker.step(new_score, accept, score);
+      }
+      if (verbose >= 2) {
+        std::cout << "at " << temp << "  " << (double)n_accept/n_reject << " accepted" << std::endl;
+      }
+    }
+  }
+  return best;
+}
+
+// ----------------------------------------------------------------------------
+// Catalogue of optimal puzzles
+// ----------------------------------------------------------------------------
+
+// Variable length encoding of unsigned integers, 7 bits per byte
+void put_varint(std::vector<uint8_t>& out, uint64_t x) {
+  while (x >= 0x80) {
+    out.push_back((uint8_t)(x | 0x80));
+    x >>= 7;
+  }
+  out.push_back((uint8_t)x);
+}
+bool get_varint(const uint8_t*& in, const uint8_t* end, uint64_t& x) {
+  x = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t byte = *in++;
+    x |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+// Binomial coefficients C(n,k) for n <= max_n, k <= max_k, saturating at the maximum uint64_t
+class Binomials {
+public:
+  static const uint64_t SATURATED = std::numeric_limits<uint64_t>::max();
+  Binomials(int max_n, int max_k) : max_k(max_k), table((max_n+1) * (max_k+1), 0) {
+    for (int n = 0; n <= max_n; ++n) {
+      at(n,0) = 1;
+      for (int k = 1; k <= max_k && k <= n; ++k) {
+        uint64_t a = at(n-1,k-1), b = k <= n-1 ? at(n-1,k) : 0;
+        at(n,k) = a > SATURATED - b ? SATURATED : a + b;
+      }
+    }
+  }
+  uint64_t operator () (int n, int k) const {
+    if (k < 0 || k > n) return 0;
+    return table[n * (max_k+1) + k];
+  }
+private:
+  int max_k;
+  std::vector<uint64_t> table;
+  uint64_t& at(int n, int k) {
+    return table[n * (max_k+1) + k];
+  }
+};
+
+const int MAX_RANKED_OBSTACLES = 32;
+
+// Rank of a set of obstacles in the colexicographic order that next_puzzle enumerates.
+// Cells are numbered in row-major order, skipping the start, and cells must be sorted.
+uint64_t combination_rank(Binomials const& binomial, const int* cells, int k) {
+  uint64_t rank = 0;
+  for (int i = 0; i < k; ++i) rank += binomial(cells[i], i+1);
+  return rank;
+}
+void combination_unrank(Binomials const& binomial, uint64_t rank, int n, int k, int* cells) {
+  for (int i = k-1; i >= 0; --i) {
+    int c = i;
+    while (c+1 < n && binomial(c+1, i+1) <= rank) ++c;
+    rank -= binomial(c, i+1);
+    cells[i] = c;
+    n = c;
+  }
+}
+
+// Whether the obstacle combinations of w×h puzzles have ranks that fit in 64 bits
+bool can_rank_obstacles(int w, int h, int obstacles) {
+  if (obstacles < 0 || obstacles > MAX_RANKED_OBSTACLES || obstacles > w*h-1) return false;
+  return Binomials(w*h, obstacles)(w*h-1, obstacles) != Binomials::SATURATED;
+}
+
+// Records all puzzles that tie for the best score in an exhaustive search, up to symmetry.
+// Each puzzle is stored as its start cell and the combination rank of its obstacles.
+// Since brute force search enumerates start cells and ranks in increasing order,
+// we store the differences with the previous puzzle as varints. Most puzzles take only a few bytes.
+template <typename Params>
+class OptimaRecorder {
+public:
+  OptimaRecorder(int w, int h, int obstacles)
+    : w(w), h(h), obstacles(obstacles), binomial(w*h, obstacles) {
+    assert(can_rank_obstacles(w, h, obstacles));
+  }
+
+  void record(Puzzle<Params> const& puzzle, int score) {
+    if (score < best_score) return;
+    if (score > best_score) {
+      best_score = score;
+      stream.clear();
+      count = 0;
+      prev_start = prev_rank = 0;
+    }
+    int start;
+    uint64_t rank;
+    if (!is_canonical(puzzle, start, rank)) return;
+    assert(start >= prev_start);
+    put_varint(stream, start - prev_start);
+    put_varint(stream, start == prev_start ? rank - prev_rank : rank);
+    prev_start = start;
+    prev_rank = rank;
+    count++;
+  }
+
+  int score() const {
+    return best_score;
+  }
+  uint64_t size() const {
+    return count;
+  }
+
+  // Section of an optima file:
+  //   varint w, h, obstacles, edges_are_walls, score, count, stream length, followed by the stream
+  void write(std::ostream& out) const {
+    std::vector<uint8_t> header;
+    for (uint64_t x : {(uint64_t)w, (uint64_t)h, (uint64_t)obstacles, (uint64_t)Params::EDGES_ARE_WALLS,
+                       (uint64_t)best_score, count, (uint64_t)stream.size()}) {
+      put_varint(header, x);
+    }
+    out.write((const char*)header.data(), header.size());
+    out.write((const char*)stream.data(), stream.size());
+  }
+
+private:
+  int w, h, obstacles;
+  Binomials binomial;
+  int best_score = -1;
+  uint64_t count = 0;
+  int prev_start = 0;
+  uint64_t prev_rank = 0;
+  std::vector<uint8_t> stream;
+
+  // Compute start cell and rank of the puzzle.
+  // The puzzle is canonical if no mirror image has a smaller (start, rank).
+  bool is_canonical(Puzzle<Params> const& puzzle, int& start, uint64_t& rank) const {
+    int xs[MAX_RANKED_OBSTACLES], ys[MAX_RANKED_OBSTACLES];
+    int k = 0;
+    for (auto pos : puzzle) {
+      if (puzzle[pos]) {
+        xs[k] = pos.col();
+        ys[k] = pos.row();
+        k++;
+      }
+    }
+    const int num_images = w == h ? 8 : 4;
+    for (int t = 0; t < num_images; ++t) {
+      auto transform = [&](int x, int y) {
+        int tx = t & 1 ? w-1-x : x;
+        int ty = t & 2 ? h-1-y : y;
+        if (t & 4) std::swap(tx, ty);
+        return tx + ty * w;
+      };
+      int image_start = transform(puzzle.start.col(), puzzle.start.row());
+      int cells[MAX_RANKED_OBSTACLES];
+      for (int i = 0; i < k; ++i) {
+        int c = transform(xs[i], ys[i]);
+        cells[i] = c > image_start ? c - 1 : c;
+      }
+      std::sort(cells, cells + k);
+      uint64_t image_rank = combination_rank(binomial, cells, k);
+      if (t == 0) {
+        start = image_start;
+        rank = image_rank;
+      } else if (image_start < start || (image_start == start && image_rank < rank)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+const char OPTIMA_FILE_MAGIC[8] = {'I','C','E','O','P','T','1','\n'};
+
+// Read an optima file, and call
+//   fun(w, h, obstacles, edges_are_walls, score, start, obstacle_cells)
+// for each puzzle. Cells are numbered x + y*w. Returns false if the file is invalid.
+template <typename F>
+bool read_optima(std::vector<uint8_t> const& data, F fun) {
+  const uint8_t* in = data.data();
+  const uint8_t* end = in + data.size();
+  if (data.size() < sizeof(OPTIMA_FILE_MAGIC) || memcmp(in, OPTIMA_FILE_MAGIC, sizeof(OPTIMA_FILE_MAGIC))) return false;
+  in += sizeof(OPTIMA_FILE_MAGIC);
+  while (in < end) {
+    uint64_t header[7];
+    for (auto& x : header) {
+      if (!get_varint(in, end, x)) return false;
+    }
+    if (header[0] == 0 || header[1] == 0 || header[0] > 0xffff || header[1] > 0xffff) return false;
+    if (header[0] * header[1] > GLOBAL_BUFFER_SIZE) return false;
+    if (header[2] > MAX_RANKED_OBSTACLES || (uint64_t)(end - in) < header[6]) return false;
+    int w = (int)header[0], h = (int)header[1], k = (int)header[2];
+    if (!can_rank_obstacles(w, h, k)) return false;
+    const int n = w*h;
+    const uint8_t* section_end = in + header[6];
+    Binomials binomial(n, k);
+    const uint64_t num_ranks = binomial(n-1, k);
+    uint64_t start = 0, rank = 0;
+    for (uint64_t i = 0; i < header[5]; ++i) {
+      uint64_t start_delta, rank_delta;
+      if (!get_varint(in, section_end, start_delta) || !get_varint(in, section_end, rank_delta)) return false;
+      if (start_delta >= (uint64_t)n - start) return false;
+      start += start_delta;
+      if (start_delta == 0 && rank_delta >= num_ranks - rank) return false;
+      rank = start_delta == 0 ? rank + rank_delta : rank_delta;
+      if (rank >= num_ranks) return false;
+      int cells[MAX_RANKED_OBSTACLES];
+      combination_unrank(binomial, rank, w*h-1, k, cells);
+      for (int j = 0; j < k; ++j) {
+        if (cells[j] >= (int)start) cells[j]++;
+      }
+      fun(w, h, k, header[3] != 0, (int)header[4], (int)start, cells);
+    }
+    in = section_end;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Binary puzzle encoding
+// ----------------------------------------------------------------------------
+
+// A puzzle is stored as
+//   varint w, h, start*2 + ranked, with start = x + y*w
+// followed by either the obstacles as a bitmap (w*h bits in row-major order, least significant bit first),
+// or for sparse puzzles (ranked=1), varint number of obstacles and their combination rank,
+// with cells numbered as in combination_rank. We use whichever is smaller.
+// A 7×6 puzzle takes at most 9 bytes, instead of 48 as text.
+
+// Binomials for all puzzle sizes that fit in the global buffers
+Binomials const& puzzle_binomials() {
+  static const Binomials binomial(GLOBAL_BUFFER_SIZE, MAX_RANKED_OBSTACLES);
+  return binomial;
+}
+
+inline int varint_size(uint64_t x) {
+  int n = 1;
+  while (x >= 0x80) {
+    x >>= 7;
+    n++;
+  }
+  return n;
+}
+
+template <typename Params>
+void encode_puzzle(Puzzle<Params> const& puzzle, std::vector<uint8_t>& out) {
+  const int w = puzzle.w, h = puzzle.h;
+  const int start = puzzle.start.col() + puzzle.start.row() * w;
+  // obstacles as cells, skipping the start
+  int cells[MAX_RANKED_OBSTACLES] = {};
+  int k = 0;
+  bool sparse = true;
+  for (int y = 0; y < h && sparse; ++y) {
+    for (int x = 0; x < w; ++x) {
+      if (!puzzle[Coord<Params>(x,y)]) continue;
+      if (k == MAX_RANKED_OBSTACLES) {
+        sparse = false;
+        break;
+      }
+      int c = x + y*w;
+      cells[k++] = c > start ? c - 1 : c;
+    }
+  }
+  const int bitmap_size = (w*h + 7) / 8;
+  uint64_t rank = 0;
+  if (sparse) {
+    auto const& binomial = puzzle_binomials();
+    sparse = binomial(w*h - 1, k) != Binomials::SATURATED;
+    if (sparse) {
+      rank = combination_rank(binomial, cells, k);
+      sparse = varint_size(k) + varint_size(rank) < bitmap_size;
+    }
+  }
+  put_varint(out, w);
+  put_varint(out, h);
+  put_varint(out, (uint64_t)start * 2 + sparse);
+  if (sparse) {
+    put_varint(out, k);
+    put_varint(out, rank);
+  } else {
+    size_t first = out.size();
+    out.resize(first + bitmap_size, 0);
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        int c = x + y*w;
+        if (puzzle[Coord<Params>(x,y)]) out[first + c/8] |= 1 << (c%8);
+      }
+    }
+  }
+}
+
+// Size of an encoded puzzle, without decoding the rest
+bool decode_puzzle_size(const uint8_t* in, const uint8_t* end, int& w, int& h) {
+  uint64_t w64, h64;
+  if (!get_varint(in, end, w64) || !get_varint(in, end, h64)) return false;
+  if (w64 == 0 || h64 == 0 || w64 > 0xffff || h64 > 0xffff) return false;
+  w = (int)w64;
+  h = (int)h64;
+  return true;
+}
+
+// Decode a puzzle into an empty puzzle of the right size (see decode_puzzle_size), and advance in.
+template <typename Params>
+bool decode_puzzle(const uint8_t*& in, const uint8_t* end, Puzzle<Params>& puzzle) {
+  using Coord = ::Coord<Params>;
+  uint64_t w, h, start_ranked;
+  if (!get_varint(in, end, w) || !get_varint(in, end, h) || !get_varint(in, end, start_ranked)) return false;
+  if ((int)w != puzzle.w || (int)h != puzzle.h) return false;
+  const int n = puzzle.w * puzzle.h;
+  const uint64_t start = start_ranked / 2;
+  if (start >= (uint64_t)n) return false;
+  puzzle.start = Coord(start % w, start / w);
+  if (start_ranked & 1) {
+    uint64_t k, rank;
+    if (!get_varint(in, end, k) || !get_varint(in, end, rank) || k > MAX_RANKED_OBSTACLES || k > (uint64_t)n-1) return false;
+    auto const& binomial = puzzle_binomials();
+    if (rank >= binomial(n-1, k)) return false;
+    int cells[MAX_RANKED_OBSTACLES];
+    combination_unrank(binomial, rank, n-1, k, cells);
+    for (int i = 0; i < (int)k; ++i) {
+      int c = cells[i] >= (int)start ? cells[i] + 1 : cells[i];
+      puzzle.set(Coord(c % w, c / w), true);
+    }
+  } else {
+    if (end - in < (n + 7) / 8) return false;
+    for (int c = 0; c < n; ++c) {
+      if (in[c/8] & (1 << (c%8))) puzzle.set(Coord(c % w, c / w), true);
+    }
+    in += (n + 7) / 8;
+    if (puzzle[puzzle.start]) return false;
+  }
+  return true;
+}
+
+// An archive of encoded puzzles with an index, for random access:
+//   magic, puzzles, offsets of the puzzles (8 bytes each), number of puzzles, offset of the index.
+// All fixed size numbers are little endian.
+const char PUZZLE_ARCHIVE_MAGIC[8] = {'I','C','E','P','Z','L','1','\n'};
+
+inline void put_uint64(std::ostream& out, uint64_t x) {
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; ++i) bytes[i] = (uint8_t)(x >> (8*i));
+  out.write((const char*)bytes, 8);
+}
+inline uint64_t get_uint64(const uint8_t* in) {
+  uint64_t x = 0;
+  for (int i = 0; i < 8; ++i) x |= (uint64_t)in[i] << (8*i);
+  return x;
+}
+
+// Writes puzzles as they come, and the index at the end
+class PuzzleArchiveWriter {
+public:
+  explicit PuzzleArchiveWriter(std::ostream& out) : out(out) {
+    out.write(PUZZLE_ARCHIVE_MAGIC, sizeof(PUZZLE_ARCHIVE_MAGIC));
+    offset = sizeof(PUZZLE_ARCHIVE_MAGIC);
+  }
+  
+  template <typename Params>
+  void add(Puzzle<Params> const& puzzle) {
+    buffer.clear();
+    encode_puzzle(puzzle, buffer);
+    offsets.push_back(offset);
+    out.write((const char*)buffer.data(), buffer.size());
+    offset += buffer.size();
+  }
+  
+  void finish() {
+    for (uint64_t o : offsets) put_uint64(out, o);
+    put_uint64(out, offsets.size());
+    put_uint64(out, offset);
+  }
+  
+private:
+  std::ostream& out;
+  uint64_t offset;
+  std::vector<uint64_t> offsets;
+  std::vector<uint8_t> buffer;
+};
+
+// Random access to the puzzles of an archive in memory
+class PuzzleArchive {
+public:
+  static bool is_archive(const uint8_t* data, size_t size) {
+    return size >= sizeof(PUZZLE_ARCHIVE_MAGIC) && memcmp(data, PUZZLE_ARCHIVE_MAGIC, sizeof(PUZZLE_ARCHIVE_MAGIC)) == 0;
+  }
+  
+  bool open(const uint8_t* data, size_t size) {
+    const size_t header = sizeof(PUZZLE_ARCHIVE_MAGIC);
+    if (!is_archive(data, size) || size < header + 16) return false;
+    count = get_uint64(data + size - 16);
+    uint64_t index_offset = get_uint64(data + size - 8);
+    if (index_offset < header || index_offset > size - 16 || count > size / 8 || size - 16 - index_offset != count * 8) return false;
+    this->data = data;
+    index = data + index_offset;
+    records_end = index;
+    return true;
+  }
+  
+  size_t size() const {
+    return count;
+  }
+  // Start of the i-th puzzle, to decode with decode_puzzle_size and decode_puzzle
+  const uint8_t* record(size_t i) const {
+    uint64_t offset = get_uint64(index + 8*i);
+    return offset < (uint64_t)(records_end - data) ? data + offset : records_end;
+  }
+  const uint8_t* end() const {
+    return records_end;
+  }
+  
+private:
+  const uint8_t* data = nullptr;
+  const uint8_t* index = nullptr;
+  const uint8_t* records_end = nullptr;
+  uint64_t count = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Hint tables
+// ----------------------------------------------------------------------------
+
+// For one goal, the number of moves still needed from every cell and the direction of the next move,
+// from a single search back from the goal. A hint for the cell the player is on is then a lookup.
+// Each cell takes 16 bits: distance*4 + direction, or NO_HINT if the goal can't be reached from there.
+// Cells that the player can't stop on also get hints, which are just never asked for.
+struct HintTable {
+  static constexpr uint16_t NO_HINT = 0xffff;
+  int w = 0, h = 0;
+  std::vector<uint16_t> entries; // row-major
+  
+  bool has_hint(int x, int y) const {
+    return entries[x + y*w] != NO_HINT;
+  }
+  // Moves until the goal is passed, 0 on the goal itself
+  int distance(int x, int y) const {
+    return entries[x + y*w] >> 2;
+  }
+  int direction(int x, int y) const {
+    return entries[x + y*w] & 3;
+  }
+  void set(int x, int y, int distance, int direction) {
+    entries[x + y*w] = (uint16_t)(distance * 4 + direction);
+  }
+};
+
+// Fill the hint table for a goal, reusing its memory
+template <typename Params>
+void hint_table(Puzzle<Params> const& puzzle, Coord<Params> goal, HintTable& table) {
+  using Coord = ::Coord<Params>;
+  table.w = puzzle.w;
+  table.h = puzzle.h;
+  table.entries.assign(puzzle.w * puzzle.h, HintTable::NO_HINT);
+  if (puzzle[goal]) return;
+  Coord queue[Params::MAX_W*Params::MAX_H];
+  int queue_start = 0, queue_end = 0;
+  table.set(goal.col(), goal.row(), 0, LEFT);
+  auto add = [&](Coord p, int distance, int dir) {
+    if (table.has_hint(p.col(), p.row())) return;
+    table.set(p.col(), p.row(), distance, dir);
+    queue[queue_end++] = p;
+  };
+  goal_predecessors(puzzle, goal, [&](Coord p, int dir) { add(p, 1, dir); });
+  while (queue_start < queue_end) {
+    Coord pos = queue[queue_start++];
+    int next_distance = table.distance(pos.col(), pos.row()) + 1;
+    slide_predecessors(puzzle, pos, [&](Coord p, int dir) { add(p, next_distance, dir); });
+  }
+}
+
+// Follow the hints from a cell, writing the moves (L, R, U, D). Returns the number of moves, or -1 if there is no hint.
+template <typename Params>
+int hint_moves(Puzzle<Params> const& puzzle, HintTable const& table, Coord<Params> pos, char* moves) {
+  if (!table.has_hint(pos.col(), pos.row())) return -1;
+  int count = table.distance(pos.col(), pos.row());
+  for (int i = 0; i < count; ++i) {
+    int dir = table.direction(pos.col(), pos.row());
+    moves[i] = DIRECTION_LETTERS[dir];
+    pos = slide(puzzle, pos, dir, [](Coord<Params>) {});
+  }
+  return count;
+}
+
+// Hint tables are stored as varint w, h and then varint entry+1 for each cell (0 for NO_HINT),
+// which is one byte per cell for distances below 31.
+void encode_hints(HintTable const& table, std::vector<uint8_t>& out) {
+  put_varint(out, table.w);
+  put_varint(out, table.h);
+  for (uint16_t entry : table.entries) put_varint(out, (entry + 1) & 0xffff);
+}
+
+// Decode the hint table for a w×h puzzle. Fails for tables of another size, and for distances that no w×h puzzle has,
+// so hint_moves() can follow the decoded hints.
+bool decode_hints(const uint8_t*& in, const uint8_t* end, int w, int h, HintTable& table) {
+  uint64_t table_w, table_h;
+  if (!get_varint(in, end, table_w) || !get_varint(in, end, table_h) || table_w != (uint64_t)w || table_h != (uint64_t)h) return false;
+  table.w = w;
+  table.h = h;
+  table.entries.resize(w * h);
+  for (auto& entry : table.entries) {
+    uint64_t value;
+    if (!get_varint(in, end, value) || value > 0xffff) return false;
+    entry = (uint16_t)(value - 1);
+    if (entry != HintTable::NO_HINT && (entry >> 2) > w * h) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Exhaustive search
+// ----------------------------------------------------------------------------
+
+template <typename Params>
+struct SkipStartIterator {
+  using base_iterator = typename Puzzle<Params>::iterator;
+  base_iterator it;
+  int start;
+  explicit SkipStartIterator(Puzzle<Params> const& p)
+    : it(p.begin()), start(p.start)
+  {
+    if (*it == start) ++it;
+  }
+  void operator ++ () {
+    ++it;
+    if (*it == start) ++it;
+  }
+  Coord<Params> operator * () const {
+    return *it;
+  }
+  bool operator == (base_iterator const& that) const {
+    return it == that;
+  }
+  bool operator != (base_iterator const& that) const {
+    return it != that;
+  }
+};
+
+// move obstacles to next configuration
+// in (reversed) lexicographical order
+template <typename Params>
+bool next_puzzle(Puzzle<Params>& p) {
+  count_stat(ENUMERATED);
+  PerfPhase perf(PHASE_ENUMERATE);
+  // change "0001110" to "1100001"
+  // find obstacle
+  auto obstacle = SkipStartIterator<Params>(p);
+  while (true) {
+    if (obstacle == p.end()) return false; // no obstacles
+    if (p[*obstacle]) break;
+    ++obstacle;
+  }
+  // find clear space after obstacles
+  int num_obstacles = 0;
+  auto first_clear = obstacle;
+  while (true) {
+    if (first_clear == p.end()) return false; // last puzzle in ordering
+    if (!p[*first_clear]) break;
+    ++first_clear;
+    ++num_obstacles;
+  }
+  // move over
+  auto it = SkipStartIterator<Params>(p);
+  for (int i=0; i<num_obstacles-1; ++i) {
+    p.set(*obstacle, false);
+    p.set(*it, true);
+    ++obstacle;
+    ++it;
+  }
+  p.set(*obstacle, false);
+  p.set(*first_clear, true);
+  return true;
+}
+
+// first puzzle configuration
+template <typename Params>
+void first_puzzle(Puzzle<Params>& p, int obstacles) {
+  p.clear();
+  auto it = SkipStartIterator<Params>(p);
+  while (obstacles > 0 && it != p.end()) {
+    p.set(*it, true);
+    --obstacles;
+    ++it;
+  }
+}
+
+// All placements of a number of obstacles, for the start location of the given puzzle
+template <typename Params>
+Generator<Puzzle<Params>> all_puzzles(Puzzle<Params> puzzle, int obstacles) {
+  first_puzzle(puzzle, obstacles);
+  do {
+    co_yield puzzle;
+  } while (next_puzzle(puzzle));
+}
+
+// By mirror symmetry, we only need to consider start coordinates in top-left quadrant (including the middle row/column)
+// If w==h, by transposition we only need the upper diagonal
+template <typename Params>
+bool is_redundant_start(Coord<Params> start, int w, int h) {
+  return start.col()*2 >= w || start.row()*2 >= h || (w == h && start.row() > start.col());
+}
+
+// Number of start coordinates that a start that is not redundant stands for, itself included
+template <typename Params>
+int start_orbit_size(Coord<Params> start, int w, int h) {
+  int mirrors = (start.col()*2+1 == w ? 1 : 2) * (start.row()*2+1 == h ? 1 : 2);
+  return w == h && start.row() != start.col() ? 2 * mirrors : mirrors;
+}
+
+// Try all obstacle placements for the start location of the given puzzle
+template <typename Params>
+void brute_force_search_from(Puzzle<Params> const& puzzle, int obstacles, Puzzle<Params>& best, int& best_score, const bool verbose = false,
+                             HallOfFame<Params>* hall = nullptr, OptimaRecorder<Params>* optima = nullptr,
+                             ScoreHistogram* histogram = nullptr) {
+  const int weight = start_orbit_size(puzzle.start, puzzle.w, puzzle.h);
+  for (auto const& p : all_puzzles(puzzle, obstacles)) {
+    int score = max_distance(p);
+    if (histogram) histogram->add(score, weight);
+    offer(hall, p, score);
+    if (optima) optima->record(p, score);
+    if (score > best_score) {
+      best_score = score;
+      best = p;
+      if (verbose) show(best);
+    }
+  }
+}
+
+template <typename Params>
+Puzzle<Params> brute_force_search(int w, int h, int obstacles = 8, const bool verbose = false,
+                                  HallOfFame<Params>* hall = nullptr, OptimaRecorder<Params>* optima = nullptr,
+                                  ScoreHistogram* histogram = nullptr) {
+  Puzzle<Params> best(w,h);
+  int best_score = -1;
+  
+  Puzzle<Params> puzzle(w,h);
+  for (auto start_coord : puzzle) {
+    if (is_redundant_start(start_coord, w, h)) {
+      if (verbose) std::cout << "Skip " << start_coord << " (" << start_coord.col() << "," << start_coord.row() << ")" << std::endl;
+      continue;
+    }
+    puzzle.start = start_coord;
+    TraceSpan span("start", "x", start_coord.col(), "y", start_coord.row());
+    if (verbose) std::cout << "Start " << start_coord << " (" << start_coord.col() << "," << start_coord.row() << ")" << std::endl;
+    brute_force_search_from(puzzle, obstacles, best, best_score, verbose, hall, optima, histogram);
+  }
+  return best;
+}
+
+// ----------------------------------------------------------------------------
+// Relative position based puzzle
+// ----------------------------------------------------------------------------
+
+enum class RelativePosition {
+  SAME,
+  NEXT,
+  SKIP,
+};
+
+// A puzzle where obstacles are placed relative to each other
+// Obstacles and start location are placed from left to right
+// vertical positions are placed top to bottom, and we use a permutation to pick a vertical location
+//
+// We have num_objects-1 obstacles and 1 start location.
+// There are num_objects+1 horizontal and vertical relative positions (between walls and objects)
+template <int MAX_OBSTACLES = 64>
+struct RelativePuzzle {
+  int num_objects;
+  RelativePosition horizontal_pos[MAX_OBSTACLES];
+  RelativePosition vertical_pos[MAX_OBSTACLES];
+  int permutation[MAX_OBSTACLES];
+  int start_index;
+
+  // require:
+  //   * with o obstacles, have o+1 objects, o+2 relative positions
+  //   * // don't overlap wall
+  //     horizontal_pos[0] != SAME && horizontal_pos[o+1] != SAME
+  //     vertical_pos[0] != SAME && vertical_pos[o+1] != SAME
+  //   * if horizontal_pos[i] == SAME, then
+  //       not all j in perm[i]..perm[i+1] have vertical_pos[j] == SAME
+  //       permutation[i] < permutation[i+1]
+  //   * for uniqueness: permutation[0] <= n/2
+  //       otherwise we could vertical flip
+  //   * for uniqueness: start_index <= n/2
+  //       otherwise we could horizontal flip
+  
+  static void to_coords(const RelativePosition* rel_pos, int n, int* coords, int& w) {
+    int x = -1;
+    for (int i=0; i<n+1; ++i) {
+      if      (rel_pos[i] == RelativePosition::SAME) x += 0;
+      else if (rel_pos[i] == RelativePosition::NEXT) x += 1;
+      else if (rel_pos[i] == RelativePosition::SKIP) x += 4;
+      coords[i] = x;
+    }
+    w = coords[n];
+  }
+  
+  template <typename Params>
+  bool to_puzzle(Puzzle<Params>& puzzle) const {
+    int x_coords[MAX_OBSTACLES];
+    int y_coords[MAX_OBSTACLES];
+    to_coords(horizontal_pos, num_objects, x_coords, puzzle.w);
+    to_coords(vertical_pos, num_objects, y_coords, puzzle.h);
+    if (puzzle.w == 0 || puzzle.w > Params::MAX_W-1 || x_coords[0] == -1) return false;
+    if (puzzle.h == 0 || puzzle.h > Params::MAX_H   || y_coords[0] == -1) return false;
+    puzzle.clear();
+    for (int i=0; i<num_objects; ++i) {
+      auto pos = Coord<Params>(x_coords[i], y_coords[permutation[i]]);
+      if (i == start_index) {
+        puzzle.start = pos;
+      } else {
+        puzzle.set(pos, true);
+      }
+    }
+    return true;
+  }
+};
+
+RelativePuzzle<> first_relative_puzzle(int obstacles, bool allow_same) {
+  RelativePuzzle<> p;
+  p.num_objects = obstacles + 1;
+  p.start_index = 0;
+  for (int i = 0; i < p.num_objects+1; ++i) {
+    auto pos = i == 0 || i == p.num_objects || !allow_same ? RelativePosition::NEXT : RelativePosition::SAME;
+    p.horizontal_pos[i] = pos;
+    p.vertical_pos[i] = pos;
+  }
+  for (int i = 0; i < p.num_objects; ++i) {
+    p.permutation[i] = i;
+  }
+  return p;
+}
+
+bool next_relative_pos(RelativePosition& p, bool at_wall) {
+  if (p == RelativePosition::SAME) {
+    p = RelativePosition::NEXT;
+    return true;
+  } else if (p == RelativePosition::NEXT) {
+    p = RelativePosition::SKIP;
+    return true;
+  } else {
+    p = at_wall ? RelativePosition::NEXT : RelativePosition::SAME;
+    return false;
+  }
+}
+template <int O>
+bool next_relative_puzzle(RelativePuzzle<O>& p, bool allow_same) {
+  count_stat(ENUMERATED);
+  PerfPhase perf(PHASE_ENUMERATE);
+  // next start location
+  ++p.start_index;
+  if (p.start_index*2 < p.num_objects) return true;
+  p.start_index = 0;
+  // next permutation?
+  if (std::next_permutation(p.permutation, p.permutation + p.num_objects) && p.permutation[0]*2 <= p.num_objects) {
+    return true;
+  }
+  for (int i = 0; i < p.num_objects; ++i) {
+    p.permutation[i] = i;
+  }
+  // next vertical/horizontal pos
+  for (int i = 0; i < p.num_objects+1; ++i) {
+    if (next_relative_pos(p.horizontal_pos[i], i == 0 || i == p.num_objects || !allow_same)) return true;
+    if (next_relative_pos(p.vertical_pos[i], i == 0 || i == p.num_objects || !allow_same)) return true;
+  }
+  return false;
+}
+
+Generator<RelativePuzzle<>> relative_puzzles(int obstacles, bool allow_same) {
+  RelativePuzzle<> rp = first_relative_puzzle(obstacles, allow_same);
+  do {
+    co_yield rp;
+  } while (next_relative_puzzle(rp, allow_same));
+}
+
+std::ostream& operator << (std::ostream& out, RelativePosition pos) {
+  return out << (pos == RelativePosition::SAME ? '0' : pos == RelativePosition::NEXT ? '1' : '2');
+}
+template <int O>
+std::ostream& operator << (std::ostream& out, RelativePuzzle<O> const& rp) {
+  out << "RP: " << rp.num_objects << " start " << rp.start_index << std::endl;
+  out << "horz: "; for (int i=0; i<rp.num_objects+1; ++i) {out << rp.horizontal_pos[i];} out << std::endl;
+  out << "vert: "; for (int i=0; i<rp.num_objects+1; ++i) {out << rp.vertical_pos[i];} out << std::endl;
+  out << "perm: "; for (int i=0; i<rp.num_objects; ++i) {out << rp.permutation[i] << " ";} out << std::endl;
+  return out;
+}
+
+template <typename Params>
+Puzzle<Params> relative_puzzle_search(int obstacles = 8, bool allow_same = false, const int verbose = 2, HallOfFame<Params>* hall = nullptr) {
+  Puzzle<Params> best(1,1);
+  int best_score = -1;
+  
+  Puzzle<Params> puzzle(1,1);
+  long long count = 0;
+  for (auto const& rp : relative_puzzles(obstacles, allow_same)) {
+    // puzzles that don't fit in Params are skipped, to_puzzle() has already changed the size
+    if (!rp.to_puzzle(puzzle)) continue;
+    count++;
+    if (verbose >= 3) {
+      std::cout << rp;
+    }
+    if (verbose >= 4) show(puzzle);
+    int score = max_distance(puzzle);
+    offer(hall, puzzle, score);
+    if (score > best_score) {
+      best_score = score;
+      best = puzzle;
+      if (verbose) {
+        show(best);
+        if (verbose >= 2) std::cout << rp;
+      }
+    }
+  }
+  if (verbose) std::cout << count << " puzzles tried" << std::endl;
+  return best;
+}
+
+// ----------------------------------------------------------------------------
+// Thread pool
+// ----------------------------------------------------------------------------
+
+// A work stealing thread pool.
+// Each worker has its own queue. Tasks submitted by a worker go to the back of its own queue,
+// and are taken from the back again, so related work stays on the same core.
+// Idle workers steal the oldest task from the front of another worker's queue.
+class ThreadPool {
+public:
+  explicit ThreadPool(int num_threads = 0) {
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < num_threads; ++i) {
+      queues.emplace_back(new Queue);
+    }
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([this,i]{ run(i); });
+    }
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& thread : threads) thread.join();
+  }
+
+  int size() const {
+    return (int)threads.size();
+  }
+
+  void submit(std::function<void()> task) {
+    int index = current_pool == this ? current_worker : (int)(next_queue++ % queues.size());
+    {
+      std::lock_guard<std::mutex> lock(queues[index]->mutex);
+      queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queued++;
+      unfinished++;
+    }
+    work_available.notify_one();
+  }
+
+  // wait until all submitted tasks are finished
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this]{ return unfinished == 0; });
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex mutex; // protects the counters below
+  std::condition_variable work_available, all_done;
+  int queued = 0;     // tasks in the queues that no worker has claimed yet
+  int unfinished = 0; // tasks submitted but not finished
+  bool stopping = false;
+  std::atomic<unsigned> next_queue{0};
+  static thread_local ThreadPool* current_pool;
+  static thread_local int current_worker;
+
+  bool try_pop(int index, std::function<void()>& task) {
+    for (int i = 0; i < (int)queues.size(); ++i) {
+      Queue& queue = *queues[(index + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) continue;
+      if (i == 0) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void run(int index) {
+    current_pool = this;
+    current_worker = index;
+    trace_thread_name("worker " + std::to_string(index));
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_available.wait(lock, [this]{ return stopping || queued > 0; });
+        if (queued == 0) return;
+        queued--;
+      }
+      // we have claimed a task, so there is one in some queue
+      std::function<void()> task;
+      while (!try_pop(index, task)) {}
+      task();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--unfinished == 0) all_done.notify_all();
+      }
+    }
+  }
+};
+thread_local ThreadPool* ThreadPool::current_pool = nullptr;
+thread_local int ThreadPool::current_worker = 0;
+
+// All-pairs distances (see above) with the starts split over a thread pool
+template <typename Params>
+void all_pairs_parallel(Puzzle<Params> const& puzzle, bool with_dists, ThreadPool& pool, AllPairs& result) {
+  SlideTable table;
+  slide_table(puzzle, table);
+  all_pairs_init(table, with_dists, result);
+  const int n = puzzle.w * puzzle.h;
+  const int chunk = std::max(1, n / (pool.size() * 8));
+  for (int first = 0; first < n; first += chunk) {
+    pool.submit([&table, &result, first, last = std::min(first + chunk, n)]{
+      all_pairs_range(table, first, last, result);
+    });
+  }
+  pool.wait();
+  result.update_best();
+}
+
+// ----------------------------------------------------------------------------
+// Pipelined exhaustive search
+// ----------------------------------------------------------------------------
+
+const int PIPELINE_BATCH_SIZE = 256;
+const int PIPELINE_MAX_OBSTACLES = 16;
+
+// A puzzle stored as its start location and the positions of its obstacles
+template <typename Params>
+struct CompactPuzzle {
+  typename Params::Index start;
+  typename Params::Index obstacles[PIPELINE_MAX_OBSTACLES];
+};
+
+template <typename Params>
+struct PuzzleBatch {
+  int size;                 // number of puzzles, or -1 to mark the end of the stream
+  int num_obstacles;
+  long long order;          // position of the batch in enumeration order, used to break ties
+  CompactPuzzle<Params> puzzles[PIPELINE_BATCH_SIZE];
+};
+
+// Turn a compact puzzle into a full puzzle, reusing a puzzle that contains the previous compact puzzle
+template <typename Params>
+void decode_into(Puzzle<Params>& puzzle, CompactPuzzle<Params> const* prev, CompactPuzzle<Params> const& cur, int num_obstacles) {
+  if (prev) {
+    for (int i = 0; i < num_obstacles; ++i) puzzle.set(prev->obstacles[i], false);
+  }
+  for (int i = 0; i < num_obstacles; ++i) puzzle.set(cur.obstacles[i], true);
+  puzzle.start = cur.start;
+}
+
+// Blocking pop that shows up in the trace when it has to wait, so we can see pipeline stalls
+template <typename T>
+void traced_pop(RingBuffer<T>& queue, T& value, const char* wait_name) {
+  if (queue.try_pop(value)) return;
+  TraceSpan span(wait_name);
+  queue.pop(value);
+}
+
+// Cheap filter: puzzles where the start is enclosed on all sides need 0 moves
+template <typename Params>
+bool start_can_move(Puzzle<Params> const& puzzle) {
+  auto s = puzzle.start;
+  return (s.col() > 0          && !puzzle[s - 1])
+      || (s.col() < puzzle.w-1 && !puzzle[s + 1])
+      || (s.row() > 0          && !puzzle[s - Params::ROW_STRIDE])
+      || (s.row() < puzzle.h-1 && !puzzle[s + Params::ROW_STRIDE]);
+}
+
+// Exhaustive search, split into a pipeline of threads connected by ring buffers:
+//  * producers enumerate obstacle placements (in the same order as next_puzzle), and write them to batches
+//  * optional filters drop puzzles that are not worth solving
+//  * solvers take whole batches and solve them, and with unique_only drop puzzles with ties or several
+//    shortest solutions, from metrics of the same solve, and puzzles that need no moves (as the filter does)
+// Returns nothing if unique_only dropped all puzzles.
+// Batches are recycled through a queue of free batches, which bounds the memory use.
+template <typename Params>
+std::optional<Puzzle<Params>> pipelined_search(int w, int h, int obstacles, int threads = 0,
+                                std::function<bool(Puzzle<Params> const&)> filter = nullptr, const bool verbose = false,
+                                HallOfFame<Params>* hall = nullptr, ScoreHistogram* histogram = nullptr,
+                                const bool unique_only = false) {
+  using Batch = PuzzleBatch<Params>;
+  using Coord = ::Coord<Params>;
+  assert(obstacles <= PIPELINE_MAX_OBSTACLES);
+  if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  const int num_producers = std::max(1, threads / 4);
+  const int num_filters = filter ? std::max(1, threads / 4) : 0;
+  const int num_solvers = std::max(1, threads - num_producers - num_filters);
+  
+  // start locations, as in brute_force_search
+  std::vector<Coord> starts;
+  for (auto start : Puzzle<Params>(w,h)) {
+    if (!is_redundant_start(start, w, h)) starts.push_back(start);
+  }
+  
+  size_t capacity = 16;
+  while (capacity < 4 * (size_t)threads) capacity *= 2;
+  std::vector<Batch> batches(capacity);
+  RingBuffer<Batch*> free_batches(capacity), enumerated(capacity), filtered(capacity);
+  for (auto& batch : batches) free_batches.push(&batch);
+  RingBuffer<Batch*>& to_solve = filter ? filtered : enumerated;
+  std::atomic<int> next_start{0}, producers_left{num_producers}, filters_left{num_filters};
+  std::atomic<long long> solved{0}, dropped{0}, not_unique{0};
+  
+  auto end_stream = [&](RingBuffer<Batch*>& queue, int consumers) {
+    for (int i = 0; i < consumers; ++i) {
+      Batch* batch;
+      free_batches.pop(batch);
+      batch->size = -1;
+      queue.push(batch);
+    }
+  };
+  
+  auto producer = [&]() {
+    trace_thread_name("producer");
+    while (true) {
+      int start_index = next_start++;
+      if (start_index >= (int)starts.size()) break;
+      TraceSpan span("start", "x", starts[start_index].col(), "y", starts[start_index].row());
+      // all cells except the start, in iteration order
+      Puzzle<Params> puzzle(w,h);
+      puzzle.start = starts[start_index];
+      std::vector<Coord> cells;
+      for (auto it = SkipStartIterator<Params>(puzzle); it != puzzle.end(); ++it) cells.push_back(*it);
+      const int n = (int)cells.size();
+      const int k = std::min(obstacles, n);
+      // obstacles as indices into cells, enumerated in colexicographic order
+      int c[PIPELINE_MAX_OBSTACLES+1];
+      for (int i = 0; i < k; ++i) c[i] = i;
+      c[k] = n;
+      long long sequence = 0;
+      bool more = true;
+      while (more) {
+        Batch* batch;
+        traced_pop(free_batches, batch, "wait for free batch");
+        batch->num_obstacles = k;
+        batch->order = ((long long)start_index << 32) + sequence++;
+        int size = 0;
+        while (more && size < PIPELINE_BATCH_SIZE) {
+          auto& out = batch->puzzles[size++];
+          out.start = puzzle.start;
+          for (int i = 0; i < k; ++i) out.obstacles[i] = cells[c[i]];
+          // next combination
+          int i = 0;
+          while (i < k && c[i] + 1 == c[i+1]) ++i;
+          if (i == k) {
+            more = false;
+          } else {
+            c[i]++;
+            for (int j = 0; j < i; ++j) c[j] = j;
+          }
+        }
+        batch->size = size;
+        count_stat(ENUMERATED, size);
+        enumerated.push(batch);
+      }
+    }
+    if (--producers_left == 0) end_stream(enumerated, filter ? num_filters : num_solvers);
+  };
+  
+  auto filter_stage = [&]() {
+    trace_thread_name("filter");
+    Puzzle<Params> puzzle(w,h);
+    CompactPuzzle<Params> const* prev = nullptr;
+    CompactPuzzle<Params> last;
+    while (true) {
+      Batch* batch;
+      traced_pop(enumerated, batch, "wait for input");
+      if (batch->size < 0) {
+        free_batches.push(batch);
+        break;
+      }
+      TraceSpan span("filter batch", "size", batch->size);
+      int kept = 0;
+      for (int i = 0; i < batch->size; ++i) {
+        decode_into(puzzle, prev, batch->puzzles[i], batch->num_obstacles);
+        last = batch->puzzles[i];
+        prev = &last;
+        if (filter(puzzle)) batch->puzzles[kept++] = batch->puzzles[i];
+      }
+      dropped += batch->size - kept;
+      batch->size = kept;
+      if (kept > 0) {
+        filtered.push(batch);
+      } else {
+        free_batches.push(batch);
+      }
+    }
+    if (--filters_left == 0) end_stream(filtered, num_solvers);
+  };
+  
+  std::mutex best_mutex;
+  Puzzle<Params> best(w,h);
+  int best_score = -1;
+  long long best_order = 0;
+  auto solver = [&]() {
+    Puzzle<Params> puzzle(w,h);
+    CompactPuzzle<Params> const* prev = nullptr;
+    CompactPuzzle<Params> last;
+    Puzzle<Params> local_best(w,h);
+    int local_score = -1;
+    long long local_order = 0;
+    long long count = 0, local_not_unique = 0;
+    ScoreHistogram local_histogram;
+    trace_thread_name("solver");
+    while (true) {
+      Batch* batch;
+      traced_pop(to_solve, batch, "wait for input");
+      if (batch->size < 0) {
+        free_batches.push(batch);
+        break;
+      }
+      TraceSpan span("solve batch", "size", batch->size);
+      for (int i = 0; i < batch->size; ++i) {
+        decode_into(puzzle, prev, batch->puzzles[i], batch->num_obstacles);
+        last = batch->puzzles[i];
+        prev = &last;
+        int score = unique_only ? max_distance<false, true>(puzzle) : max_distance(puzzle);
+        if (histogram) local_histogram.add(score, start_orbit_size(puzzle.start, w, h));
+        if (unique_only && (score == 0 || max_distance_cells > 1 || pass_paths[max_distance_cell] > 1)) {
+          local_not_unique++;
+          continue;
+        }
+        offer(hall, puzzle, score);
+        long long order = batch->order * PIPELINE_BATCH_SIZE + i;
+        if (score > local_score || (score == local_score && order < local_order)) {
+          local_best = puzzle;
+          local_score = score;
+          local_order = order;
+        }
+      }
+      count += batch->size;
+      free_batches.push(batch);
+    }
+    solved += count;
+    not_unique += local_not_unique;
+    std::lock_guard<std::mutex> lock(best_mutex);
+    if (histogram) histogram->merge(local_histogram);
+    if (local_score > best_score || (local_score == best_score && local_order < best_order)) {
+      best = local_best;
+      best_score = local_score;
+      best_order = local_order;
+    }
+  };
+  
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_producers; ++i) workers.emplace_back(producer);
+  for (int i = 0; i < num_filters; ++i) workers.emplace_back(filter_stage);
+  for (int i = 0; i < num_solvers; ++i) workers.emplace_back(solver);
+  for (auto& worker : workers) worker.join();
+  
+  if (verbose) {
+    std::cout << num_producers << " producers, " << num_filters << " filters, " << num_solvers << " solvers: "
+              << solved << " solved, " << dropped << " filtered out";
+    if (unique_only) std::cout << ", " << not_unique << " without a unique solution";
+    std::cout << std::endl;
+  }
+  if (best_score < 0 && unique_only) return std::nullopt;
+  if (best_score < 0) {
+    // the filter dropped every puzzle, so they all need 0 moves: return the first one enumerated
+    best.start = starts[0];
+    int placed = 0;
+    for (auto it = SkipStartIterator<Params>(best); it != best.end() && placed < obstacles; ++it) {
+      best.set(*it, true);
+      placed++;
+    }
+  }
+  return best;
+}
+
+// ----------------------------------------------------------------------------
+// Runtime dispatch of puzzle sizes
+// ----------------------------------------------------------------------------
+
+// Params for puzzles of at most W by H
+template <int W, int H, bool EDGES_ARE_WALLS>
+using ParamsFor = Params<USE_SENTINEL_OPTIMIZATION && EDGES_ARE_WALLS ? W+1 : W, H, EDGES_ARE_WALLS>;
+
+template <int W, int H>
+struct Size {
+  static const int MAX_W = W, MAX_H = H;
+};
+template <typename... Sizes>
+struct SizeList {};
+
+// The sizes for which we instantiate the solver and search strategies.
+// These are exact sizes that we commonly search, and padded size classes for everything else.
+// The last one is the largest that fits in the global buffers, so it is the fallback for all other sizes.
+using SIZES = SizeList<
+  Size<7,6>, Size<8,8>, Size<10,10>, Size<16,16>, Size<30,10>, Size<30,30>,
+  Size<32,32>, Size<63,64>
+>;
+
+// Used to pass a type to a generic lambda
+template <typename T>
+struct Tag {
+  using type = T;
+};
+
+template <bool EDGES_ARE_WALLS, typename F, typename... Sizes>
+bool dispatch_size(int w, int h, F&& fun, SizeList<Sizes...>) {
+  // find the smallest size that fits
+  int best = -1, best_area = std::numeric_limits<int>::max(), i = 0;
+  ((Sizes::MAX_W >= w && Sizes::MAX_H >= h && Sizes::MAX_W * Sizes::MAX_H < best_area
+      ? (best = i, best_area = Sizes::MAX_W * Sizes::MAX_H) : 0, ++i), ...);
+  if (best < 0) return false;
+  i = 0;
+  ((i++ == best ? (fun(Tag<ParamsFor<Sizes::MAX_W, Sizes::MAX_H, EDGES_ARE_WALLS>>()), 0) : 0), ...);
+  return true;
+}
+
+// Call fun(Tag<Params>()) with the tightest Params instantiation for a w by h puzzle.
+// Returns false if the puzzle is too large for all instantiations.
+template <typename F>
+bool with_params(int w, int h, bool edges_are_walls, F&& fun) {
+  if (w <= 0 || h <= 0) return false;
+  if (edges_are_walls) {
+    return dispatch_size<true>(w, h, fun, SIZES());
+  } else {
+    return dispatch_size<false>(w, h, fun, SIZES());
+  }
+}
+
+enum class Strategy {
+  BRUTE_FORCE,
+  GREEDY,
+  SIMULATED_ANNEALING,
+  RELATIVE,
+  PIPELINE
+};
+
+const char* strategy_name(Strategy strategy) {
+  switch (strategy) {
+    case Strategy::BRUTE_FORCE:         return "brute-force";
+    case Strategy::GREEDY:              return "greedy";
+    case Strategy::SIMULATED_ANNEALING: return "annealing";
+    case Strategy::RELATIVE:            return "relative";
+    case Strategy::PIPELINE:            return "pipeline";
+  }
+  return "";
+}
+
+bool parse_strategy(const char* name, Strategy& strategy) {
+  for (auto s : {Strategy::BRUTE_FORCE, Strategy::GREEDY, Strategy::SIMULATED_ANNEALING, Strategy::RELATIVE, Strategy::PIPELINE}) {
+    if (strcmp(name, strategy_name(s)) == 0) {
+      strategy = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Parses a number of obstacles "N" or a range "MIN-MAX"
+bool parse_obstacle_range(const char* text, int& min_obstacles, int& max_obstacles) {
+  int end = 0;
+  if (sscanf(text, "%d%n", &min_obstacles, &end) != 1) return false;
+  max_obstacles = min_obstacles;
+  if (text[end] == '-') {
+    text += end + 1;
+    end = 0;
+    if (sscanf(text, "%d%n", &max_obstacles, &end) != 1) return false;
+  }
+  return text[end] == '\0';
+}
+
+// Returns nothing if no puzzle has a unique solution, with unique_only
+template <typename Params>
+std::optional<Puzzle<Params>> run_strategy(Strategy strategy, int w, int h, int obstacles, int verbose, HallOfFame<Params>* hall = nullptr,
+                            ScoreHistogram* histogram = nullptr, bool unique_only = false) {
+  // the filter would hide puzzles from the histogram
+  auto filter = histogram ? nullptr : start_can_move<Params>;
+  switch (strategy) {
+    case Strategy::BRUTE_FORCE:         return brute_force_search<Params>(w,h,obstacles,verbose,hall,nullptr,histogram);
+    case Strategy::SIMULATED_ANNEALING: return simulated_annealing_search<Params>(w,h,obstacles,verbose,ANNEALING_RUNS,hall);
+    case Strategy::RELATIVE:            return relative_puzzle_search<Params>(obstacles,false,verbose,hall);
+    case Strategy::PIPELINE:
+      // compact puzzles have room for PIPELINE_MAX_OBSTACLES, more obstacles need the plain exhaustive search
+      if (obstacles > PIPELINE_MAX_OBSTACLES) return brute_force_search<Params>(w,h,obstacles,verbose,hall,nullptr,histogram);
+      return pipelined_search<Params>(w,h,obstacles,0,filter,verbose,hall,histogram,unique_only);
+    default:                            return greedy_optimize_from_random<Params>(w,h,obstacles,verbose,GREEDY_RUNS,hall);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Batch jobs
+// ----------------------------------------------------------------------------
+
+// A job is a search for puzzles of one size, for a range of obstacle counts.
+// In a job file each line is a job:
+//   WIDTH HEIGHT MIN[-MAX] STRATEGY [BUDGET [SEED]] [no-walls] [top=K] [all-optima]
+// The budget is the number of runs for greedy and annealing searches, 0 for the default.
+// With top=K the job also reports the K best distinct puzzles, with all-optima all optimal puzzles (up to K).
+// Empty lines and lines starting with '#' are ignored.
+struct Job {
+  int id; // line number in the job file
+  int w, h;
+  int min_obstacles, max_obstacles;
+  Strategy strategy;
+  int budget = 0;
+  unsigned seed = 0;
+  bool edges_are_walls = true;
+  int top = 0;
+  bool all_optima = false;
+};
+
+// Default number of puzzles to keep for --all-optima
+const int ALL_OPTIMA_CAPACITY = 1000;
+
+// Runs per subtask for greedy search, so large jobs are spread over all threads
+const int GREEDY_RUNS_PER_TASK = 100;
+
+bool parse_job(std::string const& line, Job& job) {
+  std::istringstream in(line);
+  std::string obstacles, strategy, word;
+  if (!(in >> job.w >> job.h >> obstacles >> strategy)) return false;
+  if (!parse_obstacle_range(obstacles.c_str(), job.min_obstacles, job.max_obstacles)) return false;
+  if (!parse_strategy(strategy.c_str(), job.strategy)) return false;
+  int numbers = 0;
+  while (in >> word) {
+    if (word == "no-walls") {
+      job.edges_are_walls = false;
+    } else if (word.compare(0, 4, "top=") == 0) {
+      job.top = atoi(word.c_str() + 4);
+    } else if (word == "all-optima") {
+      job.all_optima = true;
+    } else if (isdigit((unsigned char)word[0]) && numbers == 0) {
+      job.budget = atoi(word.c_str());
+      numbers++;
+    } else if (isdigit((unsigned char)word[0]) && numbers == 1) {
+      job.seed = (unsigned)strtoul(word.c_str(), nullptr, 10);
+      numbers++;
+    } else {
+      return false;
+    }
+  }
+  // a puzzle has at most w*h-1 obstacles, one cell is left for the start
+  return job.w > 0 && job.h > 0 && job.top >= 0
+    && job.min_obstacles >= 0 && job.min_obstacles <= job.max_obstacles && job.max_obstacles < job.w * job.h;
+}
+
+bool read_jobs(std::istream& in, std::vector<Job>& jobs) {
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line)) {
+    line_number++;
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') continue;
+    Job job;
+    job.id = line_number;
+    if (!parse_job(line, job)) {
+      std::cerr << "Invalid job on line " << line_number << ": " << line << std::endl;
+      return false;
+    }
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+// Writes the results of each job to its own file, or to stdout
+struct JobWriter {
+  std::string directory; // empty for stdout
+  std::mutex mutex;
+  std::atomic<bool> failed{false}; // the results of some job could not be written
+
+  void write(Job const& job, std::string const& text) {
+    if (directory.empty()) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!(std::cout << text << std::flush)) {
+        std::cerr << "Can't write results of job on line " << job.id << std::endl;
+        failed = true;
+      }
+    } else {
+      std::string file = directory + "/job-" + std::to_string(job.id) + ".txt";
+      std::ofstream out(file);
+      out << text;
+      out.close();
+      if (!out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cerr << "Can't write results of job on line " << job.id << " to " << file << std::endl;
+        failed = true;
+      }
+    }
+  }
+};
+
+// The results of the subtasks of a job
+template <typename Params>
+struct JobState {
+  Job job;
+  JobWriter& writer;
+  std::mutex mutex;
+  // per number of obstacles: the best puzzle, and the order of the subtask that found it.
+  // For equal scores we keep the puzzle from the first subtask, so the result doesn't depend on scheduling.
+  std::vector<Puzzle<Params>> best;
+  std::vector<int> best_score, best_order;
+  std::vector<std::unique_ptr<HallOfFame<Params>>> halls; // shared by all subtasks, if requested
+  std::atomic<int> remaining{0};
+
+  JobState(Job const& job, JobWriter& writer)
+    : job(job), writer(writer)
+    , best(job.max_obstacles - job.min_obstacles + 1, Puzzle<Params>(job.w, job.h))
+    , best_score(best.size(), -1)
+    , best_order(best.size(), 0)
+  {
+    for (size_t i = 0; i < best.size(); ++i) {
+      if (job.top > 0 || job.all_optima) {
+        halls.emplace_back(new HallOfFame<Params>(job.top > 0 ? job.top : ALL_OPTIMA_CAPACITY, job.all_optima));
+      } else {
+        halls.emplace_back(nullptr);
+      }
+    }
+  }
+
+  HallOfFame<Params>* hall(int obstacles) {
+    return halls[obstacles - job.min_obstacles].get();
+  }
+
+  void offer(int obstacles, Puzzle<Params> const& puzzle, int score, int order) {
+    int i = obstacles - job.min_obstacles;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (score > best_score[i] || (score == best_score[i] && order < best_order[i])) {
+      best[i] = puzzle;
+      best_score[i] = score;
+      best_order[i] = order;
+    }
+  }
+
+  void finish() {
+    std::ostringstream out;
+    out << "job " << job.id << ": " << job.w << "×" << job.h << " " << strategy_name(job.strategy) << std::endl;
+    for (size_t i = 0; i < best.size(); ++i) {
+      out << "=============" << std::endl;
+      show(best[i], Style::BOX_DRAWING, false, out);
+      if (halls[i]) {
+        out << "----- " << (job.all_optima ? "optimal" : "best") << " puzzles" << std::endl;
+        halls[i]->show_all(out, false);
+      }
+    }
+    writer.write(job, out.str());
+  }
+};
+
+// Split a job into subtasks, and submit them to the pool
+template <typename Params>
+void schedule_job(ThreadPool& pool, Job const& job, JobWriter& writer) {
+  auto state = std::make_shared<JobState<Params>>(job, writer);
+  std::vector<std::function<void()>> tasks;
+  const int w = job.w, h = job.h;
+  for (int o = job.min_obstacles; o <= job.max_obstacles; ++o) {
+    // each subtask gets its own seed, derived from the job seed
+    auto task = [&](auto search) {
+      int order = (int)tasks.size();
+      unsigned seed = job.seed;
+      tasks.push_back([state,o,order,seed,search]{
+        TraceSpan span("subtask", "job", state->job.id, "obstacles", o);
+        std::seed_seq seq{seed, (unsigned)o, (unsigned)order};
+        rng.seed(seq);
+        int score = -1;
+        Puzzle<Params> best = search(score, state->hall(o));
+        state->offer(o, best, score, order);
+      });
+    };
+    switch (job.strategy) {
+      case Strategy::BRUTE_FORCE:
+      case Strategy::PIPELINE: {
+        // one subtask per start location, the pool already keeps all cores busy
+        for (auto start : Puzzle<Params>(w,h)) {
+          if (is_redundant_start(start, w, h)) continue;
+          task([=](int& score, HallOfFame<Params>* hall) {
+            TraceSpan span("start", "x", start.col(), "y", start.row());
+            Puzzle<Params> puzzle(w,h), best(w,h);
+            puzzle.start = start;
+            brute_force_search_from(puzzle, o, best, score, false, hall);
+            return best;
+          });
+        }
+        break;
+      }
+      case Strategy::GREEDY: {
+        int runs = job.budget > 0 ? job.budget : GREEDY_RUNS;
+        for (int i = 0; i < runs; i += GREEDY_RUNS_PER_TASK) {
+          int chunk = std::min(GREEDY_RUNS_PER_TASK, runs - i);
+          task([=](int& score, HallOfFame<Params>* hall) {
+            auto best = greedy_optimize_from_random<Params>(w,h,o,false,chunk,hall);
+            score = max_distance(best);
+            return best;
+          });
+        }
+        break;
+      }
+      case Strategy::SIMULATED_ANNEALING: {
+        int runs = job.budget > 0 ? job.budget : ANNEALING_RUNS;
+        for (int i = 0; i < runs; ++i) {
+          task([=](int& score, HallOfFame<Params>* hall) {
+            auto best = simulated_annealing_search<Params>(w,h,o,0,1,hall);
+            score = max_distance(best);
+            return best;
+          });
+        }
+        break;
+      }
+      case Strategy::RELATIVE: {
+        task([=](int& score, HallOfFame<Params>* hall) {
+          auto best = relative_puzzle_search<Params>(o,false,0,hall);
+          score = max_distance(best);
+          return best;
+        });
+        break;
+      }
+    }
+  }
+  if (tasks.empty()) {
+    state->finish();
+    return;
+  }
+  state->remaining = (int)tasks.size();
+  trace_async_begin("job", job.id, "line", job.id);
+  for (auto& task : tasks) {
+    pool.submit([state,task]{
+      task();
+      if (--state->remaining == 0) {
+        state->finish();
+        trace_async_end("job", state->job.id);
+      }
+    });
+  }
+}
+
+int run_jobs(std::vector<Job> const& jobs, std::string const& out_directory, int threads) {
+  ThreadPool pool(threads);
+  JobWriter writer;
+  writer.directory = out_directory;
+  for (auto const& job : jobs) {
+    bool ok = with_params(job.w, job.h, job.edges_are_walls, [&](auto tag) {
+      schedule_job<typename decltype(tag)::type>(pool, job, writer);
+    });
+    if (!ok) {
+      std::cerr << "Unsupported puzzle size for job on line " << job.id << ": " << job.w << "×" << job.h << std::endl;
+      writer.failed = true;
+    }
+  }
+  pool.wait();
+  return writer.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// ----------------------------------------------------------------------------
+// Batch scoring
+// ----------------------------------------------------------------------------
+
+// Score many puzzles from a file or stdin, on all cores, and write one line per puzzle, in input order:
+//   ID MOVES X,Y [PATH]
+// where X,Y is the goal and PATH the moves of a solution (L, R, U, D),
+// optionally followed by the puzzle rendered as by show() and a blank line,
+// and by the hints for this goal: the direction of the next move from each cell.
+// With --best-start, the line also has the best start for the obstacles, its score and its goal:
+//   ID MOVES X,Y [PATH] best MOVES X,Y X,Y
+// In the input, puzzles are blocks of rows ('#' obstacle, '.' empty, 'S' start) separated by blank lines.
+// A block can start with a line "> ID", otherwise the id is the number of the puzzle, counting from 1.
+// The input can also be a puzzle archive (see Binary puzzle encoding).
+
+// The input, memory mapped if it is a file
+class InputBuffer {
+public:
+  ~InputBuffer() {
+    if (mapped) munmap(mapped, size);
+  }
+  bool open(std::string const& file) {
+    if (file == "-") {
+      char buffer[1 << 16];
+      size_t n;
+      while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0) copy.insert(copy.end(), buffer, buffer + n);
+      data = copy.data();
+      size = copy.size();
+      return true;
+    }
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0;
+    size = ok ? info.st_size : 0;
+    if (ok && size > 0) {
+      void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ok = false;
+      } else {
+        madvise(p, size, MADV_SEQUENTIAL);
+        mapped = p;
+        data = (const char*)p;
+      }
+    }
+    close(fd);
+    return ok;
+  }
+  
+  const char* begin() const { return data; }
+  const char* end() const { return data + size; }
+  
+private:
+  const char* data = nullptr;
+  size_t size = 0;
+  void* mapped = nullptr;
+  std::vector<char> copy;
+};
+
+// Where a puzzle is in the input. Only pointers into the input, so splitting the input doesn't allocate per line.
+struct PuzzleInput {
+  const char* rows; // first row, or the encoded puzzle
+  bool binary;
+  int w, h;
+  long long number;
+  const char* id;   // nullptr to use the number
+  int id_length;
+  const char* error;
+};
+
+inline const char* next_line(const char* p, const char* end) {
+  const char* newline = (const char*)memchr(p, '\n', end - p);
+  return newline ? newline + 1 : end;
+}
+// Length of the line at p, without the line ending
+inline int line_length(const char* p, const char* end) {
+  const char* newline = (const char*)memchr(p, '\n', end - p);
+  const char* line_end = newline ? newline : end;
+  if (line_end > p && line_end[-1] == '\r') line_end--;
+  return (int)(line_end - p);
+}
+
+void split_puzzles(const char* p, const char* end, std::vector<PuzzleInput>& puzzles) {
+  long long number = 0;
+  while (p < end) {
+    if (line_length(p, end) == 0) {
+      p = next_line(p, end);
+      continue;
+    }
+    PuzzleInput text{nullptr, false, 0, 0, ++number, nullptr, 0, nullptr};
+    if (*p == '>') {
+      text.id = p + 1;
+      text.id_length = line_length(p, end) - 1;
+      while (text.id_length > 0 && *text.id == ' ') text.id++, text.id_length--;
+      p = next_line(p, end);
+    }
+    text.rows = p;
+    int length;
+    while (p < end && (length = line_length(p, end)) > 0) {
+      if (text.h == 0) text.w = length;
+      else if (length != text.w && !text.error) text.error = "rows have different lengths";
+      text.h++;
+      p = next_line(p, end);
+    }
+    if (text.h == 0 && !text.error) text.error = "no rows";
+    puzzles.push_back(text);
+  }
+}
+
+void split_archive(PuzzleArchive const& archive, std::vector<PuzzleInput>& puzzles) {
+  puzzles.reserve(archive.size());
+  for (size_t i = 0; i < archive.size(); ++i) {
+    PuzzleInput input{(const char*)archive.record(i), true, 0, 0, (long long)i + 1, nullptr, 0, nullptr};
+    if (!decode_puzzle_size(archive.record(i), archive.end(), input.w, input.h)) input.error = "invalid encoding";
+    puzzles.push_back(input);
+  }
+}
+
+// Parse the rows of a puzzle into an empty puzzle of the right size. Returns an error message, or nullptr.
+template <typename Params>
+const char* parse_puzzle_input(PuzzleInput const& text, const char* end, Puzzle<Params>& puzzle) {
+  using Coord = ::Coord<Params>;
+  if (text.binary) {
+    const uint8_t* in = (const uint8_t*)text.rows;
+    return decode_puzzle(in, (const uint8_t*)end, puzzle) ? nullptr : "invalid encoding";
+  }
+  int starts = 0;
+  const char* row = text.rows;
+  for (int y = 0; y < text.h; ++y) {
+    for (int x = 0; x < text.w; ++x) {
+      char c = row[x];
+      if (c == '#' || c == '*') {
+        puzzle.set(Coord(x,y), true);
+      } else if (c == 'S' || c == 's' || c == '0') {
+        puzzle.start = Coord(x,y);
+        starts++;
+      } else if (c != '.') {
+        return "unexpected character";
+      }
+    }
+    row = next_line(row, end);
+  }
+  if (starts != 1) return starts == 0 ? "no start" : "more than one start";
+  return nullptr;
+}
+
+// Score some puzzles, and append a line for each to out, and the rendered puzzle if there is a render style.
+// Rendering reuses the distances and the path of the scoring pass.
+void score_puzzles(PuzzleInput const* puzzles, int count, const char* end, bool edges_are_walls, bool with_path,
+                   std::optional<Style> render_style, bool with_hints, bool best_start, std::string& out) {
+  char line[512];
+  HintTable hints;
+  AllPairs all;
+  for (int i = 0; i < count; ++i) {
+    PuzzleInput const& text = puzzles[i];
+    if (text.id) out.append(text.id, text.id_length);
+    else out += std::to_string(text.number);
+    const char* error = text.error;
+    bool ok = error || with_params(text.w, text.h, edges_are_walls, [&](auto tag) {
+      using Params = typename decltype(tag)::type;
+      Puzzle<Params> puzzle(text.w, text.h);
+      error = parse_puzzle_input(text, end, puzzle);
+      if (error) return;
+      int score = with_path || render_style ? max_distance<true>(puzzle) : max_distance(puzzle);
+      auto goal = find_goal(puzzle, score);
+      int n = snprintf(line, sizeof(line), " %d %d,%d", score, goal.col(), goal.row());
+      out.append(line, n);
+      if (with_path) {
+        char moves[256];
+        int num_moves = solution_moves(puzzle, goal, moves);
+        out += ' ';
+        out.append(moves, num_moves);
+      }
+      if (best_start) {
+        all_pairs(puzzle, false, all);
+        n = snprintf(line, sizeof(line), " best %d %d,%d %d,%d", all.best_score, all.best_start % all.w, all.best_start / all.w,
+                     all.best_goal % all.w, all.best_goal / all.w);
+        out.append(line, n);
+      }
+      if (render_style) {
+        out += '\n';
+        render(puzzle, score, goal, *render_style, false, out);
+      }
+      if (with_hints) {
+        hint_table(puzzle, goal, hints);
+        out += '\n';
+        for (int y = 0; y < puzzle.h; ++y) {
+          for (int x = 0; x < puzzle.w; ++x) {
+            Coord<Params> pos(x,y);
+            out += puzzle[pos] ? '#' : pos == goal ? 'E' : hints.has_hint(x,y) ? DIRECTION_LETTERS[hints.direction(x,y)] : '.';
+          }
+          out += '\n';
+        }
+      }
+    });
+    if (!ok) error = "too large";
+    if (error) {
+      out += " error ";
+      out += error;
+    }
+    out += '\n';
+  }
+}
+
+bool parse_style(std::string const& name, Style& style) {
+  if (name == "plain") style = Style::PUZZLE_ONLY;
+  else if (name == "distances") style = Style::DISTANCES;
+  else if (name == "path") style = Style::BOX_DRAWING;
+  else return false;
+  return true;
+}
+
+const int SCORE_CHUNK_SIZE = 1024;
+
+// Run produce(chunk, out) for all chunks on a thread pool, in any order, and write the outputs to stdout in chunk order,
+// each as soon as it is done
+template <typename Produce>
+void write_chunks_in_order(int num_chunks, int threads, Produce&& produce) {
+  struct Chunk {
+    std::string out;
+    bool done = false;
+  };
+  std::vector<Chunk> chunks(num_chunks);
+  std::mutex mutex;
+  std::condition_variable chunk_done;
+  ThreadPool pool(threads);
+  for (int c = 0; c < num_chunks; ++c) {
+    pool.submit([&,c]{
+      std::string out;
+      produce(c, out);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks[c].out.swap(out);
+        chunks[c].done = true;
+      }
+      chunk_done.notify_all();
+    });
+  }
+  for (int c = 0; c < num_chunks; ++c) {
+    std::string out;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      chunk_done.wait(lock, [&]{ return chunks[c].done; });
+      out.swap(chunks[c].out);
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+  }
+  fflush(stdout);
+  pool.wait();
+}
+
+// Convert puzzles from text to an archive, or from an archive to text (to_text).
+// Ids of text puzzles are not kept, archived puzzles are numbered.
+int convert_puzzles(std::string const& in_file, std::string const& out_file, bool to_text, bool edges_are_walls) {
+  InputBuffer input;
+  if (!input.open(in_file)) {
+    std::cerr << "Can't read " << in_file << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<PuzzleInput> puzzles;
+  PuzzleArchive archive;
+  const char* end = input.end();
+  if (to_text != PuzzleArchive::is_archive((const uint8_t*)input.begin(), input.end() - input.begin())) {
+    std::cerr << in_file << (to_text ? " is not" : " is already") << " a puzzle archive" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (to_text) {
+    if (!archive.open((const uint8_t*)input.begin(), input.end() - input.begin())) {
+      std::cerr << "Invalid puzzle archive: " << in_file << std::endl;
+      return EXIT_FAILURE;
+    }
+    split_archive(archive, puzzles);
+    end = (const char*)archive.end();
+  } else {
+    split_puzzles(input.begin(), input.end(), puzzles);
+  }
+  std::ofstream out(out_file, std::ios::binary);
+  if (!out) {
+    std::cerr << "Can't write " << out_file << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::optional<PuzzleArchiveWriter> writer;
+  if (!to_text) writer.emplace(out);
+  int errors = 0;
+  for (auto const& text : puzzles) {
+    const char* error = text.error;
+    bool ok = error || with_params(text.w, text.h, edges_are_walls, [&](auto tag) {
+      using Params = typename decltype(tag)::type;
+      Puzzle<Params> puzzle(text.w, text.h);
+      error = parse_puzzle_input(text, end, puzzle);
+      if (error) return;
+      if (to_text) {
+        out << "> " << text.number << "\n";
+        for (int y = 0; y < puzzle.h; ++y) {
+          for (int x = 0; x < puzzle.w; ++x) {
+            auto pos = Coord<Params>(x,y);
+            out << (pos == puzzle.start ? 'S' : puzzle[pos] ? '#' : '.');
+          }
+          out << "\n";
+        }
+        out << "\n";
+      } else {
+        writer->add(puzzle);
+      }
+    });
+    if (!ok) error = "too large";
+    if (error) {
+      std::cerr << "Puzzle " << text.number << ": " << error << std::endl;
+      errors++;
+    }
+  }
+  if (writer) {
+    // archives number their puzzles by position, a skipped puzzle would renumber all puzzles after it
+    if (errors > 0) {
+      out.close();
+      std::remove(out_file.c_str());
+      std::cerr << "No archive written, " << errors << " puzzles could not be read" << std::endl;
+      return EXIT_FAILURE;
+    }
+    writer->finish();
+  }
+  out.close();
+  if (!out) {
+    std::cerr << "Can't write " << out_file << std::endl;
+    return EXIT_FAILURE;
+  }
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int score_batch(std::string const& file, bool edges_are_walls, bool with_path, std::optional<Style> render_style, bool with_hints,
+                bool best_start, int threads) {
+  InputBuffer input;
+  if (!input.open(file)) {
+    std::cerr << "Can't read " << file << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<PuzzleInput> puzzles;
+  PuzzleArchive archive;
+  const char* end = input.end();
+  if (PuzzleArchive::is_archive((const uint8_t*)input.begin(), input.end() - input.begin())) {
+    if (!archive.open((const uint8_t*)input.begin(), input.end() - input.begin())) {
+      std::cerr << "Invalid puzzle archive: " << file << std::endl;
+      return EXIT_FAILURE;
+    }
+    split_archive(archive, puzzles);
+    end = (const char*)archive.end();
+  } else {
+    split_puzzles(input.begin(), input.end(), puzzles);
+  }
+  
+  const int num_chunks = ((int)puzzles.size() + SCORE_CHUNK_SIZE - 1) / SCORE_CHUNK_SIZE;
+  write_chunks_in_order(num_chunks, threads, [&](int c, std::string& out) {
+    int first = c * SCORE_CHUNK_SIZE;
+    int count = std::min(SCORE_CHUNK_SIZE, (int)puzzles.size() - first);
+    // box drawing characters take 3 bytes
+    out.reserve(count * (32 + (render_style ? 64 + 3 * (puzzles[first].w + 1) * puzzles[first].h : 0)
+                             + (with_hints ? (puzzles[first].w + 1) * puzzles[first].h : 0)));
+    score_puzzles(&puzzles[first], count, end, edges_are_walls, with_path, render_style, with_hints, best_start, out);
+  });
+  return EXIT_SUCCESS;
+}
+
+const int CHECK_CHUNK_SIZE = 16384;
+
+// Check solutions, one per line, of the first puzzle in a file (text or archive), on all cores,
+// and write a line for each, in input order: "ok MOVES", or the reason for rejecting it and the index of the bad move.
+// The goal is the one the solver picks (see find_goal). Writes a summary to stderr.
+int check_solutions(std::string const& puzzle_file, std::string const& solutions_file, bool edges_are_walls, int threads) {
+  using Clock = std::chrono::steady_clock;
+  auto begin = Clock::now();
+  InputBuffer puzzle_input, input;
+  if (!puzzle_input.open(puzzle_file) || !input.open(solutions_file)) {
+    std::cerr << "Can't read " << puzzle_file << " or " << solutions_file << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<PuzzleInput> puzzles;
+  PuzzleArchive archive;
+  const char* puzzle_end = puzzle_input.end();
+  if (PuzzleArchive::is_archive((const uint8_t*)puzzle_input.begin(), puzzle_input.end() - puzzle_input.begin())) {
+    if (!archive.open((const uint8_t*)puzzle_input.begin(), puzzle_input.end() - puzzle_input.begin())) {
+      std::cerr << "Invalid puzzle archive: " << puzzle_file << std::endl;
+      return EXIT_FAILURE;
+    }
+    split_archive(archive, puzzles);
+    puzzle_end = (const char*)archive.end();
+  } else {
+    split_puzzles(puzzle_input.begin(), puzzle_input.end(), puzzles);
+  }
+  if (puzzles.empty()) {
+    std::cerr << "No puzzle in " << puzzle_file << std::endl;
+    return EXIT_FAILURE;
+  }
+  
+  std::vector<const char*> lines;
+  for (const char* p = input.begin(); p < input.end(); p = next_line(p, input.end())) lines.push_back(p);
+  const int NUM_STATUSES = (int)ReplayStatus::MOVES_AFTER_GOAL + 1;
+  std::atomic<long long> counts[NUM_STATUSES] = {};
+  std::atomic<long long> optimal{0};
+  const char* error = puzzles[0].error;
+  int score = 0;
+  bool ok = error || with_params(puzzles[0].w, puzzles[0].h, edges_are_walls, [&](auto tag) {
+    using Params = typename decltype(tag)::type;
+    Puzzle<Params> puzzle(puzzles[0].w, puzzles[0].h);
+    error = parse_puzzle_input(puzzles[0], puzzle_end, puzzle);
+    if (error) return;
+    score = max_distance(puzzle);
+    const SolutionChecker checker(puzzle, find_goal(puzzle, score));
+    const int num_chunks = ((int)lines.size() + CHECK_CHUNK_SIZE - 1) / CHECK_CHUNK_SIZE;
+    write_chunks_in_order(num_chunks, threads, [&](int c, std::string& out) {
+      int first = c * CHECK_CHUNK_SIZE;
+      int last = std::min(first + CHECK_CHUNK_SIZE, (int)lines.size());
+      long long chunk_counts[NUM_STATUSES] = {}, chunk_optimal = 0;
+      char line[64];
+      out.reserve((last - first) * 16);
+      for (int i = first; i < last; ++i) {
+        Replay replay = checker.check(lines[i], line_length(lines[i], input.end()));
+        chunk_counts[(int)replay.status]++;
+        if (replay.status == ReplayStatus::OK && replay.moves == score) chunk_optimal++;
+        int n = snprintf(line, sizeof(line), "%s %d\n", replay_status_name(replay.status), replay.moves);
+        out.append(line, n);
+      }
+      for (int s = 0; s < NUM_STATUSES; ++s) counts[s] += chunk_counts[s];
+      optimal += chunk_optimal;
+    });
+  });
+  if (!ok) error = "too large";
+  if (error) {
+    std::cerr << "Puzzle in " << puzzle_file << ": " << error << std::endl;
+    return EXIT_FAILURE;
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  std::cerr << lines.size() << " solutions in " << seconds << " s (" << (long long)(lines.size() / std::max(seconds, 1e-9))
+            << "/s), optimum " << score << " moves:";
+  for (int s = 0; s < NUM_STATUSES; ++s) std::cerr << " " << replay_status_name((ReplayStatus)s) << " " << counts[s];
+  std::cerr << ", optimal " << optimal << std::endl;
+  return EXIT_SUCCESS;
+}
+
+// ----------------------------------------------------------------------------
+// Differential testing
+// ----------------------------------------------------------------------------
+
+// Every variant of the solver must give the same score, pass distances and number of reachable cells
+// as a simple reference implementation, and the same metrics if it computes them. --difftest N checks all registered variants on N random puzzles,
+// and shrinks any mismatch to a small puzzle that still shows it.
+
+// A puzzle without any of the layout tricks of Puzzle<Params>
+struct PlainPuzzle {
+  int w, h;
+  bool edges_are_walls;
+  int start_x, start_y;
+  std::vector<bool> obstacles; // row-major
+  
+  bool obstacle(int x, int y) const {
+    return obstacles[y*w + x];
+  }
+};
+
+struct SolveResult {
+  int score;
+  int reachable;
+  std::vector<int> pass_dists; // row-major, -1 for unreachable cells
+  // metrics, only compared if both results have them
+  int max_cells = -1;          // cells at the maximum distance
+  std::vector<int> pass_paths; // row-major, shortest paths (saturating), 0 for unreachable cells
+  
+  bool operator == (SolveResult const& that) const {
+    bool metrics = max_cells < 0 || that.max_cells < 0 || (max_cells == that.max_cells && pass_paths == that.pass_paths);
+    return score == that.score && reachable == that.reachable && pass_dists == that.pass_dists && metrics;
+  }
+};
+
+// Breadth first search over stop points, moving one cell at a time with explicit bounds checks.
+// Like max_distance, a slide off the edge (without walls) is not a move, but it does pass the cells on its way.
+SolveResult reference_solve(PlainPuzzle const& p) {
+  const int UNSEEN = -1;
+  std::vector<int> dist(p.w*p.h, UNSEEN), stop_paths(p.w*p.h, 0);
+  SolveResult result{0, 1, std::vector<int>(p.w*p.h, UNSEEN), 0, std::vector<int>(p.w*p.h, 0)};
+  std::deque<std::pair<int,int>> queue;
+  dist[p.start_y*p.w + p.start_x] = result.pass_dists[p.start_y*p.w + p.start_x] = 0;
+  stop_paths[p.start_y*p.w + p.start_x] = result.pass_paths[p.start_y*p.w + p.start_x] = 1;
+  queue.emplace_back(p.start_x, p.start_y);
+  const int dx[] = {-1, 1, 0, 0}, dy[] = {0, 0, -1, 1};
+  while (!queue.empty()) {
+    auto [x0, y0] = queue.front();
+    queue.pop_front();
+    int next = dist[y0*p.w + x0] + 1;
+    int paths = stop_paths[y0*p.w + x0];
+    for (int dir = 0; dir < 4; ++dir) {
+      int x = x0, y = y0;
+      bool off_edge = false;
+      while (true) {
+        int nx = x + dx[dir], ny = y + dy[dir];
+        if (nx < 0 || ny < 0 || nx >= p.w || ny >= p.h) {
+          off_edge = !p.edges_are_walls;
+          break;
+        }
+        if (p.obstacle(nx, ny)) break;
+        x = nx;
+        y = ny;
+        int& pass = result.pass_dists[y*p.w + x];
+        if (pass == UNSEEN) {
+          pass = next;
+          result.reachable++;
+          result.score = std::max(result.score, next);
+        }
+        if (pass == next) result.pass_paths[y*p.w + x] = std::min(result.pass_paths[y*p.w + x] + paths, PATHS_SATURATED);
+      }
+      if (off_edge) continue;
+      if (dist[y*p.w + x] == UNSEEN) {
+        dist[y*p.w + x] = next;
+        queue.emplace_back(x, y);
+      }
+      if (dist[y*p.w + x] == next) stop_paths[y*p.w + x] = std::min(stop_paths[y*p.w + x] + paths, PATHS_SATURATED);
+    }
+  }
+  result.max_cells = (int)std::count(result.pass_dists.begin(), result.pass_dists.end(), result.score);
+  return result;
+}
+
+template <typename Params>
+Puzzle<Params> to_puzzle(PlainPuzzle const& plain) {
+  using Coord = ::Coord<Params>;
+  Puzzle<Params> puzzle(plain.w, plain.h);
+  for (int y = 0; y < plain.h; ++y) {
+    for (int x = 0; x < plain.w; ++x) {
+      if (plain.obstacle(x,y)) puzzle.set(Coord(x,y), true);
+    }
+  }
+  puzzle.start = Coord(plain.start_x, plain.start_y);
+  return puzzle;
+}
+
+// Solve with max_distance, and read the pass distances from the row-major or the transposed buffer
+template <typename Params, bool track_come_from, bool transposed = false, bool with_metrics = false>
+SolveResult solve_with_max_distance(PlainPuzzle const& plain) {
+  auto puzzle = to_puzzle<Params>(plain);
+  SolveResult result{max_distance<track_come_from, with_metrics>(puzzle), reachable_cells, std::vector<int>(plain.w*plain.h), -1, {}};
+  for (int y = 0; y < plain.h; ++y) {
+    for (int x = 0; x < plain.w; ++x) {
+      Coord<Params> pos(x,y);
+      Distance d = transposed ? pass_dists_t[pos.transposed()] : pass_dists[pos];
+      result.pass_dists[y*plain.w + x] = d == UNREACHABLE ? -1 : d;
+      if (with_metrics) result.pass_paths.push_back(pass_paths[pos]);
+    }
   }
-  for (int i = 0; i < p.num_objects; ++i) {
-    p.permutation[i] = i;
+  if (with_metrics) {
+    result.max_cells = max_distance_cells;
+    // the cell it reports must be at the maximum distance
+    if (pass_dists[max_distance_cell] != result.score) result.max_cells = -2;
   }
-  return p;
+  return result;
 }
 
-bool next_relative_pos(RelativePosition& p, bool at_wall) {
-  if (p == RelativePosition::SAME) {
-    p = RelativePosition::NEXT;
-    return true;
-  } else if (p == RelativePosition::NEXT) {
-    p = RelativePosition::SKIP;
-    return true;
-  } else {
-    p = at_wall ? RelativePosition::NEXT : RelativePosition::SAME;
-    return false;
+// Solve with the tightest Params, as the searches do
+template <bool track_come_from, bool with_metrics = false>
+SolveResult solve_with_dispatch(PlainPuzzle const& plain) {
+  SolveResult result;
+  with_params(plain.w, plain.h, plain.edges_are_walls, [&](auto tag) {
+    result = solve_with_max_distance<typename decltype(tag)::type, track_come_from, false, with_metrics>(plain);
+  });
+  return result;
+}
+
+// Do the moves (L, R, U, D) work, and does the last one pass the cell x,y?
+bool replay_passes(PlainPuzzle const& p, const char* moves, int count, int gx, int gy) {
+  int x = p.start_x, y = p.start_y;
+  bool passed = false;
+  for (int i = 0; i < count; ++i) {
+    const char* letter = strchr(DIRECTION_LETTERS, moves[i]);
+    if (!letter || !*letter) return false;
+    int dir = (int)(letter - DIRECTION_LETTERS);
+    int dx = dir == LEFT ? -1 : dir == RIGHT ? 1 : 0, dy = dir == UP ? -1 : dir == DOWN ? 1 : 0;
+    passed = false;
+    while (true) {
+      int nx = x + dx, ny = y + dy;
+      if (nx < 0 || ny < 0 || nx >= p.w || ny >= p.h) {
+        if (!p.edges_are_walls) return i == count-1 && (passed || (x == gx && y == gy));
+        break;
+      }
+      if (p.obstacle(nx, ny)) break;
+      x = nx;
+      y = ny;
+      passed |= x == gx && y == gy;
+    }
   }
+  return passed;
 }
-template <int O>
-bool next_relative_puzzle(RelativePuzzle<O>& p, bool allow_same) {
-  // next start location
-  ++p.start_index;
-  if (p.start_index*2 < p.num_objects) return true;
-  p.start_index = 0;
-  // next permutation?
-  if (std::next_permutation(p.permutation, p.permutation + p.num_objects) && p.permutation[0]*2 <= p.num_objects) {
-    return true;
+
+// Pass distances from a point-to-point query for each cell, which must also return moves that pass the cell
+template <typename Params, bool bidirectional>
+SolveResult solve_with_queries(PlainPuzzle const& plain) {
+  auto puzzle = to_puzzle<Params>(plain);
+  SolveResult result{0, 0, std::vector<int>(plain.w*plain.h), -1, {}};
+  char moves[Params::MAX_W*Params::MAX_H];
+  for (int y = 0; y < plain.h; ++y) {
+    for (int x = 0; x < plain.w; ++x) {
+      Coord<Params> goal(x,y);
+      int d = bidirectional ? shortest_moves_bidirectional(puzzle, goal, moves) : shortest_moves(puzzle, goal, moves);
+      if (d == UNREACHABLE) {
+        result.pass_dists[y*plain.w + x] = -1;
+        continue;
+      }
+      if (d > 0 && !replay_passes(plain, moves, d, x, y)) d = -2;
+      result.pass_dists[y*plain.w + x] = d;
+      result.score = std::max(result.score, d);
+      result.reachable++;
+    }
   }
-  for (int i = 0; i < p.num_objects; ++i) {
-    p.permutation[i] = i;
+  return result;
+}
+
+// Pass distances from a hint table for each cell as the goal, following the hints from the start
+template <typename Params>
+SolveResult solve_with_hints(PlainPuzzle const& plain) {
+  auto puzzle = to_puzzle<Params>(plain);
+  SolveResult result{0, 0, std::vector<int>(plain.w*plain.h), -1, {}};
+  HintTable table;
+  std::vector<uint8_t> encoded;
+  char moves[Params::MAX_W*Params::MAX_H];
+  for (int y = 0; y < plain.h; ++y) {
+    for (int x = 0; x < plain.w; ++x) {
+      hint_table(puzzle, Coord<Params>(x,y), table);
+      // also check that the table survives serialisation
+      encoded.clear();
+      encode_hints(table, encoded);
+      const uint8_t* in = encoded.data();
+      if (!decode_hints(in, encoded.data() + encoded.size(), puzzle.w, puzzle.h, table)) table.entries.assign(table.entries.size(), HintTable::NO_HINT);
+      int d = hint_moves(puzzle, table, puzzle.start, moves);
+      if (d < 0) {
+        result.pass_dists[y*plain.w + x] = -1;
+        continue;
+      }
+      if (d > 0 && !replay_passes(plain, moves, d, x, y)) d = -2;
+      result.pass_dists[y*plain.w + x] = d;
+      result.score = std::max(result.score, d);
+      result.reachable++;
+    }
   }
-  // next vertical/horizontal pos
-  for (int i = 0; i < p.num_objects+1; ++i) {
-    if (next_relative_pos(p.horizontal_pos[i], i == 0 || i == p.num_objects || !allow_same)) return true;
-    if (next_relative_pos(p.vertical_pos[i], i == 0 || i == p.num_objects || !allow_same)) return true;
+  return result;
+}
+
+// Pass distances from the row of the all-pairs matrix for the start
+template <typename Params>
+SolveResult solve_with_all_pairs(PlainPuzzle const& plain) {
+  auto puzzle = to_puzzle<Params>(plain);
+  AllPairs all;
+  all_pairs(puzzle, true, all);
+  const int n = plain.w * plain.h, start = plain.start_x + plain.start_y * plain.w;
+  SolveResult result{all.scores[start], 0, std::vector<int>(n), -1, {}};
+  for (int cell = 0; cell < n; ++cell) {
+    Distance d = all.dists[(size_t)start * n + cell];
+    result.pass_dists[cell] = d == UNREACHABLE ? -1 : d;
+    if (d != UNREACHABLE) result.reachable++;
   }
-  return false;
+  // the best pair must be the best of the scores
+  if (all.best_score != *std::max_element(all.scores.begin(), all.scores.end())) result.score = -1;
+  return result;
 }
 
-std::ostream& operator << (std::ostream& out, RelativePosition pos) {
-  return out << (pos == RelativePosition::SAME ? '0' : pos == RelativePosition::NEXT ? '1' : '2');
+struct SolverVariant {
+  const char* name;
+  bool edges_are_walls;
+  int max_w, max_h;
+  SolveResult (*solve)(PlainPuzzle const&);
+};
+
+template <typename Params, bool track_come_from = false, bool transposed = false>
+SolverVariant fixed_size_variant(const char* name) {
+  return {name, Params::EDGES_ARE_WALLS, Params::MAX_W, Params::MAX_H, solve_with_max_distance<Params, track_come_from, transposed>};
 }
-template <int O>
-std::ostream& operator << (std::ostream& out, RelativePuzzle<O> const& rp) {
-  out << "RP: " << rp.num_objects << " start " << rp.start_index << std::endl;
-  out << "horz: "; for (int i=0; i<rp.num_objects+1; ++i) {out << rp.horizontal_pos[i];} out << std::endl;
-  out << "vert: "; for (int i=0; i<rp.num_objects+1; ++i) {out << rp.vertical_pos[i];} out << std::endl;
-  out << "perm: "; for (int i=0; i<rp.num_objects; ++i) {out << rp.permutation[i] << " ";} out << std::endl;
-  return out;
+
+// All solver variants that must agree with the reference. New solvers go here.
+std::vector<SolverVariant> solver_variants() {
+  return {
+    {"max_distance",           true,  63, 64, solve_with_dispatch<false>},
+    {"max_distance no walls",  false, 63, 64, solve_with_dispatch<false>},
+    {"max_distance come_from", true,  63, 64, solve_with_dispatch<true>},
+    {"max_distance metrics",   true,  63, 64, solve_with_dispatch<false, true>},
+    {"max_distance metrics no walls", false, 63, 64, solve_with_dispatch<false, true>},
+    fixed_size_variant<Params<64,64>, false, true>        ("64x64 transposed pass_dists"),
+    fixed_size_variant<Params<64,64,true,false>>          ("64x64 no sentinels"),
+    fixed_size_variant<Params<64,64,false>, true>         ("64x64 no walls come_from"),
+    fixed_size_variant<Params<64,64,false>, false, true>  ("64x64 no walls transposed pass_dists"),
+    fixed_size_variant<Params<17,5>>                      ("17x5 (lookup table coordinates)"),
+    // queries for every cell are slow on large grids
+    {"shortest_moves",                       true,  15, 16, solve_with_queries<Params<16,16>, false>},
+    {"shortest_moves no walls",              false, 16, 16, solve_with_queries<Params<16,16,false>, false>},
+    {"shortest_moves_bidirectional",         true,  15, 16, solve_with_queries<Params<16,16>, true>},
+    {"shortest_moves_bidirectional no walls", false, 16, 16, solve_with_queries<Params<16,16,false>, true>},
+    {"hint_table",                           true,  15, 16, solve_with_hints<Params<16,16>>},
+    {"hint_table no walls",                  false, 16, 16, solve_with_hints<Params<16,16,false>>},
+    {"all_pairs",                            true,  31, 32, solve_with_all_pairs<Params<32,32>>},
+    {"all_pairs no walls",                   false, 32, 32, solve_with_all_pairs<Params<32,32,false>>},
+  };
 }
 
-template <typename Params>
-Puzzle<Params> relative_puzzle_search(int obstacles = 8, bool allow_same = false, const int verbose = 2) {
-  Puzzle<Params> best(1,1);
-  int best_score = -1;
-  
-  RelativePuzzle<> rp = first_relative_puzzle(obstacles,allow_same);
-  Puzzle<Params> puzzle(1,1);
-  long long count = 0;
-  while (true) {
-    count++;
-    rp.to_puzzle(puzzle);
-    if (verbose >= 3) {
-      std::cout << rp;
-    }
-    if (verbose >= 4) show(puzzle);
-    int score = max_distance(puzzle);
-    if (score > best_score) {
-      best_score = score;
-      best = puzzle;
-      if (verbose) {
-        show(best);
-        if (verbose >= 2) std::cout << rp;
+PlainPuzzle random_plain_puzzle(bool edges_are_walls) {
+  PlainPuzzle p;
+  // mostly small puzzles, where all the edge cases are close together
+  bool small = random_range(2) == 0;
+  p.w = 1 + random_range(small ? 8 : 63);
+  p.h = 1 + random_range(small ? 8 : 64);
+  p.edges_are_walls = edges_are_walls;
+  double density = random_double() * 0.5;
+  p.obstacles.resize(p.w*p.h);
+  for (size_t i = 0; i < p.obstacles.size(); ++i) p.obstacles[i] = random_double() < density;
+  p.start_x = random_range(p.w);
+  p.start_y = random_range(p.h);
+  p.obstacles[p.start_y*p.w + p.start_x] = false;
+  return p;
+}
+
+// Remove obstacles, rows and columns, as long as the variant still disagrees with the reference
+PlainPuzzle minimize_mismatch(PlainPuzzle p, SolverVariant const& variant) {
+  auto fails = [&](PlainPuzzle const& q) {
+    return !(variant.solve(q) == reference_solve(q));
+  };
+  auto without_row = [](PlainPuzzle const& q, int row) {
+    PlainPuzzle r = q;
+    r.h--;
+    r.obstacles.erase(r.obstacles.begin() + row*q.w, r.obstacles.begin() + (row+1)*q.w);
+    if (q.start_y > row) r.start_y--;
+    return r;
+  };
+  auto without_column = [](PlainPuzzle const& q, int col) {
+    PlainPuzzle r = q;
+    r.w--;
+    r.obstacles.clear();
+    for (int y = 0; y < q.h; ++y) {
+      for (int x = 0; x < q.w; ++x) {
+        if (x != col) r.obstacles.push_back(q.obstacle(x,y));
       }
     }
-    if (!next_relative_puzzle(rp,allow_same)) break;
+    if (q.start_x > col) r.start_x--;
+    return r;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int y = p.h-1; y >= 0 && p.h > 1; --y) {
+      if (y == p.start_y) continue;
+      auto q = without_row(p, y);
+      if (fails(q)) { p = q; changed = true; }
+    }
+    for (int x = p.w-1; x >= 0 && p.w > 1; --x) {
+      if (x == p.start_x) continue;
+      auto q = without_column(p, x);
+      if (fails(q)) { p = q; changed = true; }
+    }
+    for (size_t i = 0; i < p.obstacles.size(); ++i) {
+      if (!p.obstacles[i]) continue;
+      auto q = p;
+      q.obstacles[i] = false;
+      if (fails(q)) { p = q; changed = true; }
+    }
   }
-  if (verbose) std::cout << count << " puzzles tried" << std::endl;
-  return best;
+  return p;
+}
+
+void show_plain(PlainPuzzle const& p, SolveResult const& expected, SolveResult const& actual, std::ostream& out) {
+  out << p.w << "×" << p.h << (p.edges_are_walls ? "" : ", no walls") << std::endl;
+  out << "score " << expected.score << " expected, " << actual.score << " found; reachable "
+      << expected.reachable << " expected, " << actual.reachable << " found" << std::endl;
+  if (actual.max_cells != -1) {
+    out << "cells at the maximum " << expected.max_cells << " expected, " << actual.max_cells << " found; shortest paths";
+    for (size_t i = 0; i < expected.pass_paths.size(); ++i) {
+      out << " " << expected.pass_paths[i];
+      if (i < actual.pass_paths.size() && actual.pass_paths[i] != expected.pass_paths[i]) out << "/" << actual.pass_paths[i];
+    }
+    out << std::endl;
+  }
+  out << "puzzle            pass distances (expected / found)" << std::endl;
+  for (int y = 0; y < p.h; ++y) {
+    out << "  \"";
+    for (int x = 0; x < p.w; ++x) out << (x == p.start_x && y == p.start_y ? 'S' : p.obstacle(x,y) ? '#' : '.');
+    out << "\"  ";
+    for (int x = 0; x < p.w; ++x) {
+      int e = expected.pass_dists[y*p.w + x], a = actual.pass_dists[y*p.w + x];
+      out << " " << e;
+      if (a != e) out << "/" << a;
+    }
+    out << std::endl;
+  }
+}
+
+// Returns the number of variants that disagree with the reference on at least one puzzle
+int run_difftest(int count) {
+  auto variants = solver_variants();
+  std::vector<bool> failed(variants.size(), false);
+  long long checks = 0;
+  for (int i = 0; i < count; ++i) {
+    auto puzzle = random_plain_puzzle(random_range(2) == 0);
+    auto expected = reference_solve(puzzle);
+    for (size_t v = 0; v < variants.size(); ++v) {
+      auto const& variant = variants[v];
+      if (failed[v] || variant.edges_are_walls != puzzle.edges_are_walls) continue;
+      if (puzzle.w > variant.max_w || puzzle.h > variant.max_h) continue;
+      checks++;
+      if (variant.solve(puzzle) == expected) continue;
+      // report each variant only once, with its smallest mismatch
+      failed[v] = true;
+      auto small = minimize_mismatch(puzzle, variant);
+      std::cout << "MISMATCH in " << variant.name << " (puzzle " << i << ")" << std::endl;
+      show_plain(small, reference_solve(small), variant.solve(small), std::cout);
+    }
+  }
+  int failures = (int)std::count(failed.begin(), failed.end(), true);
+  std::cout << count << " puzzles, " << checks << " checks, " << variants.size() << " variants, "
+            << failures << " with mismatches" << std::endl;
+  return failures;
 }
 
 // ----------------------------------------------------------------------------
@@ -849,39 +4635,621 @@ Puzzle<SimpleParams> test_puzzle2({
     "........",
   });
 
-int main() {
-  const bool edges_are_walls = true;
-  const int w = 7, h = 6;
-  //const int w = 8, h = 8;
-  //const int w = 10, h = 10;
-  //const int w = 16, h = 16;
-  //const int w = 30, h = 30;
-  //const int w = 30, h = 10;
-  const int min_obstacle = 2, max_obstacle = 5;
-  //const int min_obstacle = 9, max_obstacle = 11;
-  //const int min_obstacle = 7, max_obstacle = 20;
-  const bool brute_force = true;
-  const bool simulated_annealing = false;
-  const bool verbose = false;
-  using Params = ::Params<w+1,h,edges_are_walls>;
-  //using Params = ::Params<64,64,edges_are_walls>;
-  
-  if (false) {
-    relative_puzzle_search<Params>(min_obstacle);
-    return EXIT_SUCCESS;
-  }
-  
-  for (int o = min_obstacle; o <= max_obstacle; ++o) {
-    std::cout << "=============" << std::endl;
-    auto puzzle =
-      brute_force ?
-        brute_force_search<Params>(w,h,o,verbose) :
-      simulated_annealing ?
-        simulated_annealing_search<Params>(w,h,o,verbose) :
-        greedy_optimize_from_random<Params>(w,h,o,verbose);
-    show(puzzle);
+// ----------------------------------------------------------------------------
+// Benchmark
+// ----------------------------------------------------------------------------
+
+#ifdef BENCHMARK
+
+// The puzzles from the README: the optimal 7×6 puzzles, the large grid records, and the lower bound construction
+const std::vector<std::vector<std::string>> README_PUZZLES = {
+  {".....#S", ".......", "#......", ".......", ".......", "....#.."},
+  {"S#.....", "......#", ".......", "#......", ".......", "..#...."},
+  {"....#..", ".......", ".#....#", ".....#S", ".......", "..#...."},
+  {"..#S...", "...#...", "#.....#", "..#....", ".......", ".....#."},
+  {"....#..", "..#....", "...#...", "#.....#", ".......", "S#..#.."},
+  {"..S#...", "..#....", "#.#...#", "...#...", "....#..", "..#...."},
+  {"S..........#...........", ".......................", ".......................", ".......................", ".......................", "......................."},
+  {"S..........#...........", ".......................", ".......................", ".......................", ".......................", "............#.........."},
+  {"S..........#...........", ".......................", ".......................", "......................#", ".......................", ".......................", "............#.........."},
+  {"...........#...........", ".......................", ".......................", "......................#", ".......................", ".......................", "S....#......#.........."},
+  {"S.............#........", "#......................", ".......................", ".......................", ".......................", ".#.....................", "...............#.......", ".......................", ".......................", ".......................", "..#...................."},
+  {"S.............#........", "#......................", ".......................", ".......................", ".......................", "##.....................", "...............#.......", ".......................", ".......................", ".......................", "..#...................."},
+  {".......#S.....#........", "........#..............", "#......................", ".......................", ".......................", ".......................", "...............#.......", "#......................", ".......................", ".......................", ".........#............."},
+  {".......#S.....#........", "........#..............", "#......................", ".......................", ".......................", ".......#...............", ".........#.............", "...............#.......", ".......................", ".......................", "..........#............"},
+  {"..........#............", ".....#.................", "#......................", ".......................", ".......................", ".......................", ".......................", ".......................", "......................#", "...........#...........", "S#....#.........#......"},
+  {".......#....S....#.....", "............#..........", "......................#", ".......................", ".......................", ".......................", "#......................", "......#................", ".............#.........", ".......................", "...#...#..............."},
+  {"......#............#...", "..........#............", ".......#...............", "#......................", ".......................", ".......................", "........#..............", "#......................", ".......................", ".......................", ".........#....#.....#.S"},
+  {"S..#.............................................", "..........#......................................", ".................#...............................", "........................#........................", ".................................................", ".................................................", ".................................................", "..............................#..................", ".......................#.........................", "................#................................", ".........#.......................................", "..#..............................................", ".................................................", "....................................#............", ".............................#...................", "......................#..........................", "...............#.................................", "........#........................................", ".................................................", "..........................................#......", "...................................#.............", "............................#....................", ".....................#...........................", "..............#..................................", ".................................................", "................................................#", ".........................................#.......", "..................................#............#.", "...........................#............#........", "....................#............#...............", "..........................#......................"},
+};
+
+std::vector<std::string> to_rows(Puzzle<SimpleParams> const& puzzle) {
+  std::vector<std::string> rows;
+  for (int y = 0; y < puzzle.h; ++y) {
+    std::string row;
+    for (int x = 0; x < puzzle.w; ++x) {
+      auto pos = Coord<SimpleParams>(x,y);
+      row += pos == puzzle.start ? 'S' : puzzle[pos] ? '#' : '.';
+    }
+    rows.push_back(row);
   }
-  
+  return rows;
+}
+
+// Random puzzles with a fixed seed, obstacles covering the given fraction of the grid
+std::vector<std::vector<std::string>> random_rows(int w, int h, double density, int count) {
+  std::mt19937 gen(12345 + w * 1000 + h + (int)(density * 100));
+  std::vector<std::vector<std::string>> out;
+  for (int i = 0; i < count; ++i) {
+    std::vector<std::string> rows(h, std::string(w, '.'));
+    for (auto& row : rows) {
+      for (auto& c : row) {
+        if (std::uniform_real_distribution<double>(0,1)(gen) < density) c = '#';
+      }
+    }
+    rows[gen() % h][gen() % w] = 'S';
+    out.push_back(rows);
+  }
+  return out;
+}
+
+struct BenchCorpus {
+  std::string name;
+  std::vector<std::vector<std::string>> puzzles;
+};
+
+std::vector<BenchCorpus> bench_corpus() {
+  std::vector<BenchCorpus> corpus;
+  corpus.push_back({"readme 7x6", {README_PUZZLES.begin(), README_PUZZLES.begin() + 6}});
+  corpus.push_back({"readme large", {README_PUZZLES.begin() + 6, README_PUZZLES.end() - 1}});
+  corpus.push_back({"lower bound", {README_PUZZLES.back()}});
+  corpus.push_back({"test puzzles", {to_rows(test_puzzle), to_rows(test_puzzle2)}});
+  for (auto size : {std::make_pair(7,6), std::make_pair(16,16), std::make_pair(30,30), std::make_pair(60,60)}) {
+    for (double density : {0.05, 0.15, 0.30}) {
+      corpus.push_back({"random " + std::to_string(size.first) + "x" + std::to_string(size.second) + " " + std::to_string((int)(density * 100)) + "%",
+                        random_rows(size.first, size.second, density, 20)});
+    }
+  }
+  return corpus;
+}
+
+volatile long long bench_sink;
+
+// Time solve(puzzle, goal) for all puzzles in each corpus that fit in Params,
+// with a goal chosen at random (but always the same) among the reachable cells
+template <typename Params, typename Solve>
+void bench_puzzles(const char* name, std::vector<BenchCorpus> const& corpus, Solve&& solve) {
+  using Clock = std::chrono::steady_clock;
+  const double MIN_SECONDS = 0.2;
+  for (auto const& group : corpus) {
+    std::vector<Puzzle<Params>> puzzles;
+    std::vector<Coord<Params>> goals;
+    std::mt19937 gen(54321);
+    long long cells = 0;
+    for (auto const& rows : group.puzzles) {
+      if ((int)rows.size() > Params::MAX_H || (int)rows[0].size() > Params::MAX_W) continue;
+      puzzles.emplace_back(rows);
+      cells += (long long)rows.size() * rows[0].size();
+      max_distance(puzzles.back());
+      std::vector<Coord<Params>> reachable;
+      for (auto pos : puzzles.back()) {
+        if (pass_dists[pos] != UNREACHABLE) reachable.push_back(pos);
+      }
+      goals.push_back(reachable[gen() % reachable.size()]);
+    }
+    if (puzzles.empty()) continue;
+    long long solves = 0, sum = 0, rounds = 0;
+    auto begin = Clock::now();
+    double seconds = 0;
+    while (seconds < MIN_SECONDS) {
+      for (size_t i = 0; i < puzzles.size(); ++i) {
+        sum += solve(puzzles[i], goals[i]);
+      }
+      solves += puzzles.size();
+      rounds++;
+      seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+    bench_sink = sum;
+    double ns = seconds * 1e9;
+    printf("%-34s %-18s %10.1f %12.0f %9.3f\n", name, group.name.c_str(),
+           ns / solves, solves / seconds, cells * rounds / ns);
+  }
+}
+
+template <typename Params, bool track_come_from>
+void bench_solver(const char* name, std::vector<BenchCorpus> const& corpus) {
+  bench_puzzles<Params>(name, corpus, [](Puzzle<Params> const& puzzle, Coord<Params>) {
+    return max_distance<track_come_from>(puzzle);
+  });
+}
+
+// Scores of all starts, on all cores. Compare with max_distance times the number of free cells.
+template <typename Params>
+void bench_all_pairs(const char* name, std::vector<BenchCorpus> const& corpus) {
+  ThreadPool pool;
+  AllPairs result;
+  bench_puzzles<Params>(name, corpus, [&](Puzzle<Params> const& puzzle, Coord<Params>) {
+    all_pairs_parallel(puzzle, false, pool, result);
+    return result.best_score;
+  });
+}
+
+// Point-to-point queries, with the moves
+template <typename Params, bool bidirectional>
+void bench_query(const char* name, std::vector<BenchCorpus> const& corpus) {
+  bench_puzzles<Params>(name, corpus, [](Puzzle<Params> const& puzzle, Coord<Params> goal) {
+    char moves[Params::MAX_W*Params::MAX_H];
+    return bidirectional ? shortest_moves_bidirectional(puzzle, goal, moves) : shortest_moves(puzzle, goal, moves);
+  });
+}
+
+int run_benchmarks() {
+  auto corpus = bench_corpus();
+  printf("%-34s %-18s %10s %12s %9s\n", "solver", "corpus", "ns/solve", "solves/s", "cells/ns");
+  bench_solver<Params<8,6>, false>                     ("8x6 sentinels",                 corpus);
+  bench_solver<Params<32,32>, false>                   ("32x32 sentinels",               corpus);
+  bench_solver<Params<32,32>, true>                    ("32x32 sentinels come_from",     corpus);
+  bench_solver<Params<32,32,true,false>, false>        ("32x32 no sentinels",            corpus);
+  bench_solver<Params<32,32,false>, false>             ("32x32 no walls",                corpus);
+  bench_solver<Params<64,64>, false>                   ("64x64 sentinels",               corpus);
+  bench_solver<Params<64,64>, true>                    ("64x64 sentinels come_from",     corpus);
+  bench_solver<Params<64,64,true,false>, false>        ("64x64 no sentinels",            corpus);
+  bench_solver<Params<64,64,false>, false>             ("64x64 no walls",                corpus);
+  bench_solver<Params<64,64,false>, true>              ("64x64 no walls come_from",      corpus);
+  bench_query<Params<64,64>, false>                    ("64x64 shortest_moves",          corpus);
+  bench_query<Params<64,64>, true>                     ("64x64 shortest_moves bidir",    corpus);
+  bench_all_pairs<Params<64,64>>                       ("64x64 all_pairs (all starts)",  corpus);
+  return EXIT_SUCCESS;
+}
+
+// Known optima: the 7×6 puzzles proven optimal by brute force, and the large grid records from the README
+struct SearchTarget {
+  const char* name;
+  int w, h;
+  int obstacles;
+  int optimum;
+};
+
+const SearchTarget SEARCH_TARGETS[] = {
+  {"7x6", 7,6, 2, 8}, {"7x6", 7,6, 3,11}, {"7x6", 7,6, 4,13}, {"7x6", 7,6, 5,16},
+  {"7x6", 7,6, 6,17}, {"7x6", 7,6, 7,19}, {"7x6", 7,6, 8,20},
+  {"large", 24,12, 1, 5}, {"large", 24,12, 2, 8}, {"large", 24,12, 3,11}, {"large", 24,12, 4,13}, {"large", 24,12, 5,17},
+  {"large", 24,12, 6,19}, {"large", 24,12, 7,22}, {"large", 24,12, 8,25}, {"large", 24,12, 9,28}, {"large", 24,12,10,30},
+};
+const int SEARCH_SEEDS[] = {1, 2, 3};
+
+// Run a search until it finds the target score or the deadline passes, and print one CSV line
+template <typename Params>
+void time_to_optimum(Strategy strategy, SearchTarget const& target, int seed, double deadline) {
+  using Clock = std::chrono::steady_clock;
+  auto begin = Clock::now();
+  SearchProbe probe{target.optimum, begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(deadline))};
+  search_probe = &probe;
+  solver_calls = 0;
+  rng.seed(seed);
+  const int runs = std::numeric_limits<int>::max();
+  try {
+    switch (strategy) {
+      case Strategy::BRUTE_FORCE:         brute_force_search<Params>(target.w, target.h, target.obstacles); break;
+      case Strategy::GREEDY:              greedy_optimize_from_random<Params>(target.w, target.h, target.obstacles, false, runs); break;
+      case Strategy::SIMULATED_ANNEALING: simulated_annealing_search<Params>(target.w, target.h, target.obstacles, 0, runs); break;
+      case Strategy::RELATIVE:            relative_puzzle_search<Params>(target.obstacles, false, 0); break;
+      default:                            break;
+    }
+  } catch (SearchStopped const&) {
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  search_probe = nullptr;
+  printf("%s,%s,%d,%d,%d,%d,%d,%d,%d,%.6f,%lld\n", strategy_name(strategy), target.name, target.w, target.h,
+         target.obstacles, target.optimum, seed, probe.best_score >= target.optimum, probe.best_score, seconds, solver_calls);
+  fflush(stdout);
+}
+
+// Time to reach each known optimum, for each search strategy.
+// The pipeline is left out: it is the brute force search spread over threads, and the probe only sees one thread.
+int run_search_benchmarks(double deadline) {
+  printf("strategy,target,width,height,obstacles,optimum,seed,reached,best,seconds,solver_calls\n");
+  for (auto const& target : SEARCH_TARGETS) {
+    bool large = strcmp(target.name, "large") == 0;
+    for (auto strategy : {Strategy::BRUTE_FORCE, Strategy::GREEDY, Strategy::SIMULATED_ANNEALING, Strategy::RELATIVE}) {
+      // relative puzzles choose their own size, they only make sense for the large grid records
+      if (strategy == Strategy::RELATIVE && !large) continue;
+      bool randomized = strategy == Strategy::GREEDY || strategy == Strategy::SIMULATED_ANNEALING;
+      for (int seed : SEARCH_SEEDS) {
+        if (strategy == Strategy::RELATIVE) {
+          time_to_optimum<ParamsFor<32,32,true>>(strategy, target, seed, deadline);
+        } else {
+          with_params(target.w, target.h, true, [&](auto tag) {
+            time_to_optimum<typename decltype(tag)::type>(strategy, target, seed, deadline);
+          });
+        }
+        if (!randomized) break;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+#endif
+
+bool read_file(std::string const& filename, std::vector<uint8_t>& data) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in) return false;
+  data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return true;
+}
+
+int decode_optima(std::string const& filename) {
+  std::vector<uint8_t> data;
+  if (!read_file(filename, data)) {
+    std::cerr << "Can't open optima file: " << filename << std::endl;
+    return EXIT_FAILURE;
+  }
+  long long count = 0;
+  bool ok = read_optima(data, [&](int w, int h, int obstacles, bool edges_are_walls, int, int start, const int* cells) {
+    count++;
+    with_params(w, h, edges_are_walls, [&](auto tag) {
+      using Params = typename decltype(tag)::type;
+      Puzzle<Params> puzzle(w,h);
+      puzzle.start = Coord<Params>(start % w, start / w);
+      for (int i = 0; i < obstacles; ++i) {
+        puzzle.set(Coord<Params>(cells[i] % w, cells[i] / w), true);
+      }
+      show(puzzle);
+    });
+  });
+  if (!ok) {
+    std::cerr << "Invalid optima file: " << filename << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << count << " puzzles" << std::endl;
   return EXIT_SUCCESS;
 }
 
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " [options]" << std::endl;
+  std::cerr << "  -w WIDTH           width of the puzzle (default 7)" << std::endl;
+  std::cerr << "  -h HEIGHT          height of the puzzle (default 6)" << std::endl;
+  std::cerr << "  -o MIN[-MAX]       number of obstacles (default 2-5)" << std::endl;
+  std::cerr << "  -s STRATEGY        brute-force, greedy, annealing, relative or pipeline (default brute-force)" << std::endl;
+  std::cerr << "  --no-walls         the edges of the grid are not walls" << std::endl;
+  std::cerr << "  --unique           with -s pipeline, only keep puzzles with a single goal and a single shortest solution" << std::endl;
+  std::cerr << "  -v                 verbose, can be repeated" << std::endl;
+  std::cerr << "  --jobs FILE        run all jobs from a job file in parallel" << std::endl;
+  std::cerr << "  --out DIR          write the result of each job to DIR/job-LINE.txt" << std::endl;
+  std::cerr << "  -j THREADS         number of threads for jobs (default: all cores)" << std::endl;
+  std::cerr << "  --top K            also show the K best distinct puzzles" << std::endl;
+  std::cerr << "  --all-optima       also show all optimal puzzles, up to symmetry (at most --top K)" << std::endl;
+  std::cerr << "  --optima FILE      brute force search, and write all optimal puzzles up to symmetry to FILE" << std::endl;
+  std::cerr << "  --decode-optima FILE  show all puzzles in an optima file" << std::endl;
+  std::cerr << "  --histogram FILE   write the distribution of scores and reachable cells of an exhaustive search" << std::endl;
+  std::cerr << "                     to FILE, as JSON if the name ends in .json, otherwise as CSV" << std::endl;
+  std::cerr << "  --stats FILE       write solver and search counters to FILE (- for stdout), as JSON if the name ends in .json" << std::endl;
+  std::cerr << "                     (needs a build with -DICE_STATS=1, which also reports them on SIGUSR1)" << std::endl;
+  std::cerr << "  --perf             report hardware counters per phase after each search (needs -DICE_STATS=1)" << std::endl;
+  std::cerr << "  --trace FILE       write a trace of the search threads to FILE, for chrome://tracing or Perfetto" << std::endl;
+  std::cerr << "  --convergence FILE  write the progress of greedy and annealing searches over time to FILE, as CSV" << std::endl;
+  std::cerr << "  --convergence-interval SECONDS  time between progress samples of a search (default 0.1)" << std::endl;
+  std::cerr << "  --seed SEED        seed for the random number generator" << std::endl;
+  std::cerr << "  --score FILE       score all puzzles in FILE (- for stdin), writing: ID MOVES X,Y of the goal" << std::endl;
+  std::cerr << "  --path             with --score, also write the moves of a solution" << std::endl;
+  std::cerr << "  --render STYLE     with --score, also write each puzzle as plain, distances or path" << std::endl;
+  std::cerr << "  --hints            with --score, also write the direction of the next move to the goal from each cell" << std::endl;
+  std::cerr << "  --best-start       with --score, also write the best start for the obstacles: best MOVES X,Y (start) X,Y (goal)" << std::endl;
+  std::cerr << "  --check PUZZLE SOLUTIONS  check the solutions (one per line, - for stdin) of the first puzzle in PUZZLE" << std::endl;
+  std::cerr << "  --pack TEXT ARCHIVE    write the puzzles in TEXT to a compact binary ARCHIVE, which --score also reads" << std::endl;
+  std::cerr << "  --unpack ARCHIVE TEXT  write the puzzles in ARCHIVE as TEXT" << std::endl;
+  std::cerr << "  --difftest N       check all solver variants against a reference solver on N random puzzles" << std::endl;
+}
+
+// Write the trace at the end of a run
+bool write_trace_file(std::string const& file) {
+  if (file.empty()) return true;
+  std::ofstream out(file);
+  if (!out) {
+    std::cerr << "Can't write trace to " << file << std::endl;
+    return false;
+  }
+  tracer.write(out);
+  return true;
+}
+
+// Write the statistics counters at the end of a run
+bool write_stats_file(std::string const& file) {
+  if (file.empty()) return true;
+  if (file == "-") {
+    write_stats(std::cout, false);
+    return true;
+  }
+  std::ofstream out(file);
+  if (!out) {
+    std::cerr << "Can't write statistics to " << file << std::endl;
+    return false;
+  }
+  write_stats(out, file.size() >= 5 && file.compare(file.size() - 5, 5, ".json") == 0);
+  return true;
+}
+
+#ifdef BENCHMARK
+int main(int argc, char** argv) {
+  if (argc >= 2 && strcmp(argv[1], "search") == 0) {
+    return run_search_benchmarks(argc >= 3 ? atof(argv[2]) : 5.0);
+  }
+  return run_benchmarks();
+}
+#else
+int main(int argc, char** argv) {
+  bool edges_are_walls = true;
+  int w = 7, h = 6;
+  int min_obstacle = 2, max_obstacle = 5;
+  Strategy strategy = Strategy::BRUTE_FORCE;
+  int verbose = 0;
+  std::string job_file, out_directory;
+  int threads = 0;
+  int top = 0;
+  bool all_optima = false;
+  std::string optima_file, histogram_file, stats_file, trace_file, convergence_file;
+  double convergence_interval = 0.1;
+  int difftest = 0;
+  std::string score_file, convert_in, convert_out, check_puzzle, check_solutions_file;
+  bool with_path = false, with_hints = false, best_start = false, unpack = false;
+  bool unique_only = false;
+  std::optional<Style> render_style;
+  if (COLLECT_STATS) report_stats_on_signal();
+  
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i+1 < argc;
+    if (arg == "-w" && has_value) {
+      w = atoi(argv[++i]);
+    } else if (arg == "-h" && has_value) {
+      h = atoi(argv[++i]);
+    } else if (arg == "-o" && has_value) {
+      if (!parse_obstacle_range(argv[++i], min_obstacle, max_obstacle)) {
+        std::cerr << "Invalid number of obstacles: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "-s" && has_value) {
+      if (!parse_strategy(argv[++i], strategy)) {
+        std::cerr << "Unknown strategy: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "--no-walls") {
+      edges_are_walls = false;
+    } else if (arg == "-v") {
+      verbose++;
+    } else if (arg == "--jobs" && has_value) {
+      job_file = argv[++i];
+    } else if (arg == "--out" && has_value) {
+      out_directory = argv[++i];
+    } else if (arg == "-j" && has_value) {
+      threads = atoi(argv[++i]);
+    } else if (arg == "--top" && has_value) {
+      top = atoi(argv[++i]);
+    } else if (arg == "--all-optima") {
+      all_optima = true;
+    } else if (arg == "--optima" && has_value) {
+      optima_file = argv[++i];
+    } else if (arg == "--histogram" && has_value) {
+      histogram_file = argv[++i];
+    } else if (arg == "--stats" && has_value) {
+      stats_file = argv[++i];
+    } else if (arg == "--perf") {
+      perf_enabled = true;
+    } else if (arg == "--unique") {
+      unique_only = true;
+    } else if (arg == "--trace" && has_value) {
+      trace_file = argv[++i];
+    } else if (arg == "--convergence" && has_value) {
+      convergence_file = argv[++i];
+    } else if (arg == "--convergence-interval" && has_value) {
+      convergence_interval = atof(argv[++i]);
+    } else if (arg == "--seed" && has_value) {
+      rng.seed(strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--score" && has_value) {
+      score_file = argv[++i];
+    } else if (arg == "--path") {
+      with_path = true;
+    } else if (arg == "--hints") {
+      with_hints = true;
+    } else if (arg == "--best-start") {
+      best_start = true;
+    } else if (arg == "--render" && has_value) {
+      Style style;
+      if (!parse_style(argv[++i], style)) {
+        std::cerr << "Unknown render style: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+      render_style = style;
+    } else if (arg == "--check" && i+2 < argc) {
+      check_puzzle = argv[++i];
+      check_solutions_file = argv[++i];
+    } else if ((arg == "--pack" || arg == "--unpack") && i+2 < argc) {
+      unpack = arg == "--unpack";
+      convert_in = argv[++i];
+      convert_out = argv[++i];
+    } else if (arg == "--difftest" && has_value) {
+      difftest = atoi(argv[++i]);
+    } else if (arg == "--decode-optima" && has_value) {
+      return decode_optima(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  
+  if ((!stats_file.empty() || perf_enabled) && !COLLECT_STATS) {
+    std::cerr << "Statistics are not compiled in, build with -DICE_STATS=1 (make ice-sliding-stats)" << std::endl;
+    return EXIT_FAILURE;
+  }
+  
+  if (difftest > 0) {
+    return run_difftest(difftest) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (!score_file.empty()) {
+    return score_batch(score_file, edges_are_walls, with_path, render_style, with_hints, best_start, threads);
+  }
+  if (!check_puzzle.empty()) {
+    return check_solutions(check_puzzle, check_solutions_file, edges_are_walls, threads);
+  }
+  if (!convert_in.empty()) {
+    return convert_puzzles(convert_in, convert_out, unpack, edges_are_walls);
+  }
+  
+  if (!trace_file.empty()) {
+    tracer.enable();
+    trace_thread_name("main");
+  }
+  
+  // the log's writer thread must be stopped before the file is closed
+  std::ofstream convergence_out;
+  std::unique_ptr<ConvergenceLog> convergence;
+  if (!convergence_file.empty()) {
+    convergence_out.open(convergence_file);
+    if (!convergence_out) {
+      std::cerr << "Can't write convergence log to " << convergence_file << std::endl;
+      return EXIT_FAILURE;
+    }
+    convergence.reset(new ConvergenceLog(convergence_out, convergence_interval));
+    convergence_log = convergence.get();
+  }
+  
+  if (!job_file.empty()) {
+    std::vector<Job> jobs;
+    std::ifstream in(job_file);
+    if (!in) {
+      std::cerr << "Can't open job file: " << job_file << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (!read_jobs(in, jobs)) return EXIT_FAILURE;
+    auto before = total_stats();
+    int result = run_jobs(jobs, out_directory, threads);
+    if (perf_enabled) write_perf_report(std::cout, before, total_stats());
+    if (!write_stats_file(stats_file) || !write_trace_file(trace_file)) return EXIT_FAILURE;
+    return result;
+  }
+  
+  // a puzzle has at most w*h-1 obstacles, one cell is left for the start
+  if (min_obstacle < 0 || min_obstacle > max_obstacle || max_obstacle >= w * h) {
+    std::cerr << "Invalid number of obstacles for a " << w << "×" << h << " puzzle: " << min_obstacle << "-" << max_obstacle << std::endl;
+    return EXIT_FAILURE;
+  }
+  
+  // the catalogue is recorded by brute_force_search, which also stands in for the pipeline
+  if (!optima_file.empty() && strategy != Strategy::BRUTE_FORCE && strategy != Strategy::PIPELINE) {
+    std::cerr << "Optimal puzzles are only collected by exhaustive searches" << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (int o = min_obstacle; !optima_file.empty() && o <= max_obstacle; ++o) {
+    if (!can_rank_obstacles(w, h, o)) {
+      std::cerr << "Can't catalogue optimal puzzles with " << o << " obstacles on a " << w << "×" << h
+                << " grid: the catalogue stores at most " << MAX_RANKED_OBSTACLES << " obstacles, as ranks that fit in 64 bits" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::ofstream optima_out;
+  if (!optima_file.empty()) {
+    optima_out.open(optima_file, std::ios::binary);
+    optima_out.write(OPTIMA_FILE_MAGIC, sizeof(OPTIMA_FILE_MAGIC));
+    if (!optima_out) {
+      std::cerr << "Can't write optimal puzzles to " << optima_file << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  
+  if (unique_only && (strategy != Strategy::PIPELINE || max_obstacle > PIPELINE_MAX_OBSTACLES || !optima_file.empty())) {
+    std::cerr << "--unique needs the pipeline strategy, with at most " << PIPELINE_MAX_OBSTACLES << " obstacles and without --optima" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!histogram_file.empty() && strategy != Strategy::BRUTE_FORCE && strategy != Strategy::PIPELINE) {
+    std::cerr << "Histograms are only collected by exhaustive searches" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::ofstream histogram_out;
+  if (!histogram_file.empty()) {
+    histogram_out.open(histogram_file);
+    if (!histogram_out) {
+      std::cerr << "Can't write histogram to " << histogram_file << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::vector<ScoreHistogram> histograms;
+  
+  bool ok = with_params(w, h, edges_are_walls, [&](auto tag) {
+    using Params = typename decltype(tag)::type;
+    for (int o = min_obstacle; o <= max_obstacle; ++o) {
+      TraceSpan span("search", "obstacles", o);
+      std::cout << "=============" << std::endl;
+      std::unique_ptr<HallOfFame<Params>> hall;
+      if (top > 0 || all_optima) {
+        hall.reset(new HallOfFame<Params>(top > 0 ? top : ALL_OPTIMA_CAPACITY, all_optima));
+      }
+      std::unique_ptr<OptimaRecorder<Params>> optima;
+      if (optima_out.is_open()) optima.reset(new OptimaRecorder<Params>(w, h, o));
+      ScoreHistogram* histogram = nullptr;
+      if (!histogram_file.empty()) {
+        histograms.emplace_back();
+        histogram = &histograms.back();
+      }
+      auto before = total_stats();
+      std::optional<Puzzle<Params>> puzzle;
+      if (optima) {
+        puzzle = brute_force_search<Params>(w, h, o, verbose, hall.get(), optima.get(), histogram);
+      } else {
+        puzzle = run_strategy<Params>(strategy, w, h, o, verbose, hall.get(), histogram, unique_only);
+      }
+      if (puzzle) {
+        show(*puzzle);
+      } else {
+        std::cout << "No puzzle with " << o << " obstacles has a unique solution" << std::endl;
+      }
+      if (perf_enabled) write_perf_report(std::cout, before, total_stats());
+      if (optima) {
+        optima->write(optima_out);
+        std::cout << optima->size() << " optimal puzzles written" << std::endl;
+      }
+      if (hall) {
+        std::cout << "----- " << (all_optima ? "optimal" : "best") << " puzzles" << std::endl;
+        hall->show_all();
+      }
+    }
+  });
+  if (!ok) {
+    std::cerr << "Unsupported puzzle size: " << w << "×" << h << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (optima_out.is_open()) {
+    optima_out.close();
+    if (!optima_out) {
+      std::cerr << "Can't write optimal puzzles to " << optima_file << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  
+  if (!histogram_file.empty()) {
+    auto& out = histogram_out;
+    bool json = histogram_file.size() >= 5 && histogram_file.compare(histogram_file.size() - 5, 5, ".json") == 0;
+    if (json) {
+      out << "{\"width\":" << w << ",\"height\":" << h << ",\"edges_are_walls\":" << (edges_are_walls ? "true" : "false") << ",\"obstacles\":{";
+      for (size_t i = 0; i < histograms.size(); ++i) {
+        out << (i ? "," : "") << "\"" << min_obstacle + i << "\":";
+        histograms[i].write_json(out);
+      }
+      out << "}}" << std::endl;
+    } else {
+      out << "obstacles,kind,value,count" << std::endl;
+      for (size_t i = 0; i < histograms.size(); ++i) {
+        histograms[i].write_csv(out, min_obstacle + (int)i);
+      }
+    }
+    out.close();
+    if (!out) {
+      std::cerr << "Can't write histogram to " << histogram_file << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  
+  if (!write_stats_file(stats_file) || !write_trace_file(trace_file)) return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+#endif